@@ -1,3 +1,3 @@
 #!/bin/zsh
-g++-15 -fopenmp src/common.cpp src/common.h src/openmp.cpp -o openmp
+g++-15 -I.. -fopenmp src/common.cpp src/common.h src/openmp.cpp -o openmp
 ./openmp input/heat_matrix.csv
\ No newline at end of file
@@ -1,2 +1,2 @@
-g++-15 src/common.cpp src/common.h src/sequential.cpp -o sequential
+g++-15 -I.. src/common.cpp src/common.h src/sequential.cpp -o sequential
 ./sequential input/heat_matrix.csv
\ No newline at end of file
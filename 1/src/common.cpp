@@ -1,6 +1,6 @@
 #include "common.h"
 
-bool read_file(double **grid, char *filename)
+bool read_file(double **grid, char *filename, int n)
 {
     std::ifstream file(filename);
     if (!file.is_open())
@@ -9,14 +9,14 @@ bool read_file(double **grid, char *filename)
         return 1;
     }
     std::string line;
-    for (int i = 1; i <= N; i++)
+    for (int i = 1; i <= n; i++)
     {
         if (!std::getline(file, line))
         {
             return false;
         }
         std::istringstream ss(line);
-        for (int j = 1; j <= N; j++)
+        for (int j = 1; j <= n; j++)
         {
             std::string token;
             if (!std::getline(ss, token, ','))
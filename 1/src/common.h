@@ -1,8 +1,19 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include "shared/checkpoint.h"
+#include "shared/converge.h"
+#include "shared/ingest.h"
+#include "shared/output.h"
+#include "shared/params.h"
+#include "shared/perf_counters.h"
+#include "shared/snapshot.h"
+#include "shared/stencil.h"
+#include "shared/trace.h"
 
-constexpr int N = 4000;
-constexpr int NUM_ITERS = 100;
+// Cost of one cell update for the SIM_PERF roofline summary: 9 multiplies
+// and 8 adds, one double read and one written.
+constexpr double FLOPS_PER_CELL = 17;
+constexpr double BYTES_PER_CELL = 16;
 
-bool read_file(double **, char *);
\ No newline at end of file
+bool read_file(double **, char *, int n);
\ No newline at end of file
@@ -1,13 +1,20 @@
 #include "common.h"
+#include "shared/autotune.h"
+#include <type_traits>
 #include <omp.h>
 
-int main(int argc, char *argv[])
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
 {
-    double kernel[3][3] = {
-        {0.05, 0.1, 0.05},
-        {0.1, 0.4, 0.1},
-        {0.05, 0.1, 0.05},
-    };
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.csv [--n n] [--steps s] [--tune off|auto|search] ..." << std::endl;
+        return 1;
+    }
+
+    const int N = p.n;
+    const int NUM_ITERS = p.steps;
+    const stencil::Heat heat(p);
 
     double **grid = new double *[N + 2];
     double **new_grid = new double *[N + 2];
@@ -17,43 +24,93 @@ int main(int argc, char *argv[])
         new_grid[i] = new double[N + 2];
         for (int j = 0; j <= N + 1; j++)
         {
-            grid[i][j] = 30.0;
-            new_grid[i][j] = 30.0;
+            grid[i][j] = stencil::Heat::BOUNDARY;
+            new_grid[i][j] = stencil::Heat::BOUNDARY;
         }
     }
-    if (!read_file(grid, argv[1]))
-        return 1;
 
-    double t0 = omp_get_wtime();
-    for (int t = 0; t < NUM_ITERS; t++)
+    // One sweep over the grid, shared by the calling team. The schedule
+    // comes from omp_set_schedule (static unless tuned). When measure is
+    // std::true_type it also measures the thread's cells into change; the
+    // plain sweep is compiled without the extra work.
+    auto sweep = [&](double **grid, double **new_grid, auto measure, converge::Change *change)
     {
-#pragma omp parallel for collapse(2)
-
+        converge::Change mine;
+#pragma omp for collapse(2) schedule(runtime) nowait
         for (int i = 1; i <= N; i++)
         {
             for (int j = 1; j <= N; j++)
             {
-                double sum = 0;
-                for (int ki = 0; ki < 3; ki++)
-                {
-                    for (int kj = 0; kj < 3; kj++)
-                    {
-                        int ni = i + ki - 1;
-                        int nj = j + kj - 1;
-
-                        sum += grid[ni][nj] * kernel[ki][kj];
-                    }
-                }
+                double sum = heat(grid[i - 1], grid[i], grid[i + 1], j);
                 new_grid[i][j] = sum;
+                if constexpr (decltype(measure)::value)
+                    mine.add(sum - grid[i][j]);
             }
         }
+        if constexpr (decltype(measure)::value)
+            *change = mine;
+    };
+
+    // Calibration steps run on the arrays before the input is read.
+    tune::Setting setting;
+    setting.threads = omp_get_max_threads();
+    tune::run(p.tune, "heat openmp", N, setting, [&](const tune::Setting &)
+              {
+#pragma omp parallel
+                  sweep(grid, new_grid, std::false_type(), nullptr); });
+
+    if (!read_file(grid, argv[1], N))
+        return 1;
+
+    checkpoint::State ckpt("heat openmp", N, N, NUM_ITERS);
+    int first = ckpt.restore([&](int i)
+                             { return grid[i + 1] + 1; });
+    snapshot::Writer snap(N, N);
+    converge::Check check(p.converge, p.converge_norm, p.converge_every, (double)N * N, omp_get_max_threads());
+    perf::Session perf("heat openmp", omp_get_max_threads(), (double)N * N, FLOPS_PER_CELL, BYTES_PER_CELL);
+    double t0 = omp_get_wtime();
+    for (int t = first; t < NUM_ITERS; t++)
+    {
+        bool measure = check.due(t);
+        if (measure)
+            check.reset();
+        perf.begin_step();
+#pragma omp parallel
+        {
+            trace::Span compute("stencil", "compute", t);
+            // nowait so each thread's counters stop before the closing barrier.
+            perf.start(omp_get_thread_num());
+            if (measure)
+                sweep(grid, new_grid, std::true_type(), &check.part(omp_get_thread_num()));
+            else
+                sweep(grid, new_grid, std::false_type(), nullptr);
+            perf.stop(omp_get_thread_num());
+            compute.end();
+
+            // Explicit so the time each thread waits for the slowest one
+            // shows up in the trace.
+            trace::Span wait("barrier", "wait", t);
+#pragma omp barrier
+        }
+        perf.end_step();
 
         double **temp = grid;
         grid = new_grid;
         new_grid = temp;
+        snap.step(t + 1, [&](int i)
+                  { return grid[i + 1] + 1; });
+        ckpt.step(t + 1, [&](int i)
+                  { return grid[i + 1] + 1; });
+        if (measure && check.done(t, check.local(check.gather())))
+            break;
     }
 
     std::cout << omp_get_wtime() - t0;
+    perf.report();
+    check.report(NUM_ITERS);
+    write_output(N, N, [&](int i)
+                 { return grid[i + 1] + 1; });
+    ckpt.finish();
 
     // for (int i = 0; i <= GRID_SIZE + 1; i++)
     // {
@@ -62,4 +119,12 @@ int main(int argc, char *argv[])
     // }
     // delete[] grid;
     // delete[] new_grid;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return heat::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                        { return simulate(p, argc, argv); });
 }
\ No newline at end of file
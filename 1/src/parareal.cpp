@@ -0,0 +1,222 @@
+#include "common.h"
+#include "shared/partition.h"
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <omp.h>
+
+// Parallel-in-time heat diffusion (Parareal):
+//
+//   build/1/parareal in.csv --steps 4000 --windows 8 --coarsen 2 --parareal-tol 1e-6
+//
+// The --steps steps are split into --windows windows (default one per
+// OpenMP thread). The fine propagator F is 1/sequential's stencil run over a
+// window; the coarse propagator G restricts the field to a grid --coarsen
+// times coarser (the mean of each c x c block), runs the same kernel there
+// for c^2 times fewer steps, which for a diffusion kernel covers about the
+// same time, and interpolates back bilinearly. Iteration 0 sweeps G over the
+// windows serially; every further iteration runs F on all unfinished windows
+// at once, one per thread, then corrects the window starts serially,
+//
+//   U[n+1] = F(U_old[n]) + G(U[n]) - G(U_old[n]),
+//
+// and stops once no cell of any window start moved by more than
+// --parareal-tol, or after --parareal-max iterations (default --windows).
+// Iteration k makes window k exact, so after --windows iterations the field
+// is 1/sequential's bit for bit. With k iterations the longest chain of fine
+// steps is k windows long instead of --windows, which is the speedup bound
+// when there are as many cores as windows. The iterations and the final
+// correction go to stderr.
+//
+// Memory is 2 * windows + threads + 1 fields of (n + 2)^2 doubles.
+namespace
+{
+    // steps steps of the stencil on an n x n field with a boundary ring,
+    // from cur; the result ends in cur.
+    void propagate(std::vector<double> &cur, std::vector<double> &next, int n, int steps, const stencil::Heat &heat)
+    {
+        for (int t = 0; t < steps; t++)
+        {
+            for (int i = 1; i <= n; i++)
+                stencil::row(heat, cur.data(), next.data(), n + 2, i, 1, n + 1);
+            std::swap(cur, next);
+        }
+    }
+
+    // The coarse grid: cells of c x c fine cells, the last row and column
+    // possibly partial, and bilinear interpolation weights back to the fine
+    // cells.
+    struct Coarse
+    {
+        int n;  // fine cells per side
+        int c;  // coarsening factor
+        int nc; // coarse cells per side
+        std::vector<int> lo;   // per fine index: the coarse index (padded) below it
+        std::vector<double> w; // and the weight of the one above
+
+        Coarse(int n, int c) : n(n), c(c), nc((n + c - 1) / c), lo(n), w(n)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                // Coarse cell a has its centre at fine coordinate (a + 0.5) c - 0.5.
+                double x = (i + 0.5) / c - 0.5;
+                int a = (int)std::floor(x);
+                lo[i] = a + 1;
+                w[i] = x - a;
+            }
+        }
+
+        // The mean of each block of fine (padded, n + 2 wide) into coarse
+        // (padded, nc + 2 wide, ring left as it is).
+        void average(const double *fine, double *coarse) const
+        {
+            const int W = n + 2, Wc = nc + 2;
+            for (int a = 0; a < nc; a++)
+            {
+                for (int b = 0; b < nc; b++)
+                {
+                    int i1 = std::min(n, (a + 1) * c), j1 = std::min(n, (b + 1) * c);
+                    double sum = 0;
+                    for (int i = a * c; i < i1; i++)
+                        for (int j = b * c; j < j1; j++)
+                            sum += fine[(i + 1) * W + j + 1];
+                    coarse[(a + 1) * Wc + b + 1] = sum / ((i1 - a * c) * (j1 - b * c));
+                }
+            }
+        }
+
+        // Cell (i, j) of the coarse field (ring included) interpolated to
+        // fine cell (i, j), 0-based.
+        double at(const double *coarse, int i, int j) const
+        {
+            const int Wc = nc + 2;
+            const double *r0 = coarse + lo[i] * Wc, *r1 = r0 + Wc;
+            int b = lo[j];
+            double fi = w[i], fj = w[j];
+            return (1 - fi) * ((1 - fj) * r0[b] + fj * r0[b + 1]) + fi * ((1 - fj) * r1[b] + fj * r1[b + 1]);
+        }
+    };
+}
+
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
+{
+    const int N = p.n;
+    const int NUM_ITERS = p.steps;
+    const stencil::Heat heat(p);
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.csv [--windows w] [--coarsen c] [--parareal-tol tol]" << std::endl;
+        return 1;
+    }
+
+    const int threads = omp_get_max_threads();
+    const int windows = std::max(1, std::min(p.windows > 0 ? p.windows : threads, std::max(1, NUM_ITERS)));
+    const int max_iters = std::min(windows, p.parareal_max > 0 ? p.parareal_max : windows);
+    const Coarse coarse(N, std::min(p.coarsen, N));
+    const int c2 = coarse.c * coarse.c;
+    const size_t cells = (size_t)(N + 2) * (N + 2);
+    const size_t coarse_cells = (size_t)(coarse.nc + 2) * (coarse.nc + 2);
+
+    // u[n]: the field at the start of window n (u[windows] at the end);
+    // f[n]: F(u[n]) from the last fine pass; g[n]: the coarse solution from
+    // u[n], before interpolation.
+    std::vector<std::vector<double>> u(windows + 1, std::vector<double>(cells, stencil::Heat::BOUNDARY));
+    std::vector<std::vector<double>> f(windows, std::vector<double>(cells, stencil::Heat::BOUNDARY));
+    std::vector<std::vector<double>> scratch(threads, std::vector<double>(cells, stencil::Heat::BOUNDARY));
+    std::vector<std::vector<double>> g(windows, std::vector<double>(coarse_cells, stencil::Heat::BOUNDARY));
+    std::vector<double> gc(coarse_cells, stencil::Heat::BOUNDARY), gc_next(coarse_cells, stencil::Heat::BOUNDARY);
+    std::vector<int> fine_steps(windows), coarse_steps(windows);
+    for (int n = 0; n < windows; n++)
+    {
+        fine_steps[n] = block_rows(NUM_ITERS, windows, n);
+        coarse_steps[n] = (fine_steps[n] + c2 / 2) / c2;
+    }
+
+    {
+        std::vector<double *> rows(N + 2);
+        for (int i = 0; i <= N + 1; i++)
+            rows[i] = u[0].data() + (size_t)i * (N + 2);
+        if (!read_file(rows.data(), argv[1], N))
+            return 1;
+    }
+
+    // G from u[n], left in gc.
+    auto coarse_solve = [&](int n)
+    {
+        coarse.average(u[n].data(), gc.data());
+        propagate(gc, gc_next, coarse.nc, coarse_steps[n], heat);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < windows; n++)
+    {
+        coarse_solve(n);
+        g[n] = gc;
+        double *out = u[n + 1].data();
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < N; j++)
+                out[(i + 1) * (N + 2) + j + 1] = coarse.at(gc.data(), i, j);
+    }
+
+    int iters = 0;
+    double correction = 0;
+    for (int k = 1; k <= max_iters; k++)
+    {
+        // Windows before k - 1 start from exact values and were already
+        // propagated exactly.
+        {
+            trace::Span span("fine", "compute", k);
+#pragma omp parallel for schedule(dynamic, 1)
+            for (int n = k - 1; n < windows; n++)
+            {
+                auto &tmp = scratch[omp_get_thread_num()];
+                f[n] = u[n];
+                propagate(f[n], tmp, N, fine_steps[n], heat);
+            }
+        }
+
+        trace::Span span("correct", "compute", k);
+        correction = 0;
+        for (int n = k - 1; n < windows; n++)
+        {
+            coarse_solve(n);
+            for (size_t c = 0; c < coarse_cells; c++)
+                g[n][c] = gc[c] - g[n][c];
+            // g[n] holds G(u[n]) - G(u_old[n]) until it is restored below.
+            double *out = u[n + 1].data();
+            const double *fine = f[n].data();
+            for (int i = 0; i < N; i++)
+            {
+                for (int j = 0; j < N; j++)
+                {
+                    size_t at = (size_t)(i + 1) * (N + 2) + j + 1;
+                    double v = fine[at] + coarse.at(g[n].data(), i, j);
+                    correction = std::max(correction, std::fabs(v - out[at]));
+                    out[at] = v;
+                }
+            }
+            g[n] = gc;
+        }
+        iters = k;
+        if (correction <= p.parareal_tol)
+            break;
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Parareal: " << std::chrono::duration<double>(end - start).count();
+    long long critical = 0;
+    for (int k = 1; k <= iters; k++)
+        critical += *std::max_element(fine_steps.begin() + (k - 1), fine_steps.end());
+    std::fprintf(stderr, "[parareal] %d windows, %d iterations, last correction %g (tolerance %g); "
+                         "%lld fine steps on the critical path of %d\n",
+                 windows, iters, correction, p.parareal_tol, critical, NUM_ITERS);
+    write_output(N, N, [&](int i)
+                 { return u[windows].data() + (size_t)(i + 1) * (N + 2) + 1; });
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return heat::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                        { return simulate(p, argc, argv); });
+}
@@ -1,13 +1,18 @@
 #include "common.h"
 #include <chrono>
 
-int main(int argc, char *argv[])
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
 {
-    double kernel[3][3] = {
-        {0.05, 0.1, 0.05},
-        {0.1, 0.4, 0.1},
-        {0.05, 0.1, 0.05},
-    };
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.csv [--n n] [--steps s] ..." << std::endl;
+        return 1;
+    }
+
+    const int N = p.n;
+    const int NUM_ITERS = p.steps;
+    const stencil::Heat heat(p);
 
     double **grid = new double *[N + 2];
     double **new_grid = new double *[N + 2];
@@ -17,46 +22,87 @@ int main(int argc, char *argv[])
         new_grid[i] = new double[N + 2];
         for (int j = 0; j <= N + 1; j++)
         {
-            grid[i][j] = 30.0;
-            new_grid[i][j] = 30.0;
+            grid[i][j] = stencil::Heat::BOUNDARY;
+            new_grid[i][j] = stencil::Heat::BOUNDARY;
         }
     }
-    if (!read_file(grid, argv[1]))
+    auto release = [&]()
+    {
+        for (int i = 0; i <= N + 1; i++)
+        {
+            delete[] grid[i];
+            delete[] new_grid[i];
+        }
+        delete[] grid;
+        delete[] new_grid;
+    };
+    checkpoint::State ckpt("heat sequential", N, N, NUM_ITERS);
+    ingest::Reader input;
+    if (ingest::enabled() && !ckpt.enabled())
+        input.start(argv[1], N, N, [rows = grid](int i)
+                    { return rows[i + 1] + 1; });
+    else if (!read_file(grid, argv[1], N))
+    {
+        release();
         return 1;
-    auto start = std::chrono::high_resolution_clock::now();
-    for (int t = 0; t < NUM_ITERS; t++)
+    }
+    int first = ckpt.restore([&](int i)
+                             { return grid[i + 1] + 1; });
+    snapshot::Writer snap(N, N);
+    converge::Check check(p.converge, p.converge_norm, p.converge_every, (double)N * N);
+    perf::Session perf("heat sequential", 1, (double)N * N, FLOPS_PER_CELL, BYTES_PER_CELL);
+    auto start = std::chrono::steady_clock::now();
+    for (int t = first; t < NUM_ITERS; t++)
     {
+        bool measure = check.due(t);
+        converge::Change change;
+        perf.begin_step();
+        perf.start(0);
         for (int i = 1; i <= N; i++)
         {
-            for (int j = 1; j <= N; j++)
+            if (input.active() && !input.wait(std::min(i + 1, N)))
             {
-                double sum = 0;
-                for (int ki = 0; ki < 3; ki++)
-                {
-                    for (int kj = 0; kj < 3; kj++)
-                    {
-                        int ni = i + ki - 1;
-                        int nj = j + kj - 1;
-
-                        sum += grid[ni][nj] * kernel[ki][kj];
-                    }
-                }
-                new_grid[i][j] = sum;
+                input.finish();
+                release();
+                return 1;
             }
+            stencil::row(heat, grid[i - 1], grid[i], grid[i + 1], new_grid[i], 1, N + 1);
+            if (measure)
+                change.add(new_grid[i] + 1, grid[i] + 1, N);
         }
+        input.finish();
+        perf.stop(0);
+        perf.end_step();
 
         double **temp = grid;
         grid = new_grid;
         new_grid = temp;
+        snap.step(t + 1, [&](int i)
+                  { return grid[i + 1] + 1; });
+        ckpt.step(t + 1, [&](int i)
+                  { return grid[i + 1] + 1; });
+        if (measure && check.done(t, check.local(change)))
+            break;
     }
-    auto end = std::chrono::high_resolution_clock::now();
-    std::cout << "Sequential: " << std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
-
-    for (int i = 0; i <= N + 1; i++)
+    if (!input.finish())
     {
-        delete[] grid[i];
-        delete[] new_grid[i];
+        release();
+        return 1;
     }
-    delete[] grid;
-    delete[] new_grid;
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Sequential: " << std::chrono::duration<double>(end - start).count();
+    perf.report();
+    check.report(NUM_ITERS);
+    write_output(N, N, [&](int i)
+                 { return grid[i + 1] + 1; });
+    ckpt.finish();
+    release();
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return heat::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                        { return simulate(p, argc, argv); });
 }
\ No newline at end of file
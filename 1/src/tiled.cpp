@@ -1,15 +1,23 @@
 #include "common.h"
+#include "shared/autotune.h"
+#include <cmath>
+#include <vector>
 #include <omp.h>
 
-#define TILE_SIZE 64
-
-int main(int argc, char *argv[])
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
 {
-    double kernel[3][3] = {
-        {0.05, 0.1, 0.05},
-        {0.1, 0.4, 0.1},
-        {0.05, 0.1, 0.05},
-    };
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.csv [--n n] [--steps s] [--tile t] ..." << std::endl;
+        return 1;
+    }
+
+    const int N = p.n;
+    const int NUM_ITERS = p.steps;
+    int tile_i = p.tile_i;
+    int tile_j = p.tile_j;
+    const stencil::Heat heat(p);
 
     double **grid = new double *[N + 2];
     double **new_grid = new double *[N + 2];
@@ -19,51 +27,173 @@ int main(int argc, char *argv[])
         new_grid[i] = new double[N + 2];
         for (int j = 0; j <= N + 1; j++)
         {
-            grid[i][j] = 30.0;
-            new_grid[i][j] = 30.0;
+            grid[i][j] = stencil::Heat::BOUNDARY;
+            new_grid[i][j] = stencil::Heat::BOUNDARY;
         }
     }
-    if (!read_file(grid, argv[1]))
-        return 1;
 
-    double t0 = omp_get_wtime();
-    for (int t = 0; t < NUM_ITERS; t++)
+    // Updates the tile at (ti, tj). With tol >= 0 it also reports whether
+    // any cell moved by more than tol from its previous value, the centre
+    // of its stencil; with change set it adds the tile's rows to it.
+    auto update = [&](double **grid, double **new_grid, int ti, int tj, double tol, converge::Change *change)
     {
+        int i_end = std::min(ti + tile_i, N + 1);
+        int j_end = std::min(tj + tile_j, N + 1);
+        double moved = 0;
 
-#pragma omp parallel for collapse(2) schedule(static)
-        for (int ti = 1; ti <= N; ti += TILE_SIZE)
+        for (int i = ti; i < i_end; i++)
         {
-            for (int tj = 1; tj <= N; tj += TILE_SIZE)
+            for (int j = tj; j < j_end; j++)
             {
+                double sum = heat(grid[i - 1], grid[i], grid[i + 1], j);
+                new_grid[i][j] = sum;
+                if (tol >= 0)
+                    moved = std::max(moved, std::fabs(sum - grid[i][j]));
+            }
+            if (change != nullptr)
+                change->add(&new_grid[i][tj], &grid[i][tj], j_end - tj);
+        }
+        return moved > tol;
+    };
 
-                int i_end = std::min(ti + TILE_SIZE, N + 1);
-                int j_end = std::min(tj + TILE_SIZE, N + 1);
+    // One sweep over the tiles, shared by the calling team. The schedule
+    // comes from omp_set_schedule (static unless tuned). With change set it
+    // also measures the thread's tiles into it.
+    auto sweep = [&](double **grid, double **new_grid, converge::Change *change = nullptr)
+    {
+        converge::Change mine;
+#pragma omp for collapse(2) schedule(runtime) nowait
+        for (int ti = 1; ti <= N; ti += tile_i)
+        {
+            for (int tj = 1; tj <= N; tj += tile_j)
+            {
+                update(grid, new_grid, ti, tj, -1, change ? &mine : nullptr);
+            }
+        }
+        if (change != nullptr)
+            *change = mine;
+    };
 
-                for (int i = ti; i < i_end; i++)
-                {
-                    for (int j = tj; j < j_end; j++)
-                    {
-                        double sum = 0;
-                        for (int ki = 0; ki < 3; ki++)
+    // Calibration steps run on the arrays before the input is read.
+    tune::Setting setting;
+    setting.threads = omp_get_max_threads();
+    setting.tile_i = tile_i;
+    setting.tile_j = tile_j;
+    setting = tune::run(p.tune, "heat tiled", N, setting, [&](const tune::Setting &s)
                         {
-                            for (int kj = 0; kj < 3; kj++)
-                            {
-                                int ni = i + ki - 1;
-                                int nj = j + kj - 1;
-                                sum += grid[ni][nj] * kernel[ki][kj];
-                            }
-                        }
-                        new_grid[i][j] = sum;
-                    }
+                            tile_i = s.tile_i;
+                            tile_j = s.tile_j;
+#pragma omp parallel
+                            sweep(grid, new_grid); });
+    tile_i = setting.tile_i;
+    tile_j = setting.tile_j;
+
+    if (!read_file(grid, argv[1], N))
+        return 1;
+
+    // With --skip, a tile is only updated when it or one of its 8
+    // neighbours moved in the previous step. Otherwise its stencil reads the
+    // same values as one step earlier, so new_grid, which holds that step's
+    // result, is already right. Exact mode reproduces the full sweep bit for
+    // bit; a tolerance also skips tiles that barely move.
+    const int tiles_i = (N + tile_i - 1) / tile_i;
+    const int tiles_j = (N + tile_j - 1) / tile_j;
+    std::vector<char> moved(p.skip >= 0 ? tiles_i * tiles_j : 0, 1);
+    std::vector<int> active;
+    long long updated = 0;
+    auto rebuild = [&]()
+    {
+        active.clear();
+        for (int bi = 0; bi < tiles_i; bi++)
+        {
+            for (int bj = 0; bj < tiles_j; bj++)
+            {
+                bool any = false;
+                for (int di = std::max(bi - 1, 0); di <= std::min(bi + 1, tiles_i - 1) && !any; di++)
+                {
+                    for (int dj = std::max(bj - 1, 0); dj <= std::min(bj + 1, tiles_j - 1) && !any; dj++)
+                        any = moved[di * tiles_j + dj];
                 }
+                if (any)
+                    active.push_back(bi * tiles_j + bj);
             }
         }
+        std::fill(moved.begin(), moved.end(), 0);
+        updated += active.size();
+    };
+    // Skipped tiles hold the same values in both grids, so they add no
+    // change.
+    auto sweep_active = [&](double **grid, double **new_grid, converge::Change *change)
+    {
+        converge::Change mine;
+#pragma omp for schedule(runtime) nowait
+        for (size_t a = 0; a < active.size(); a++)
+        {
+            int b = active[a];
+            moved[b] = update(grid, new_grid, 1 + b / tiles_j * tile_i, 1 + b % tiles_j * tile_j, p.skip,
+                              change ? &mine : nullptr);
+        }
+        if (change != nullptr)
+            *change = mine;
+    };
+
+    checkpoint::State ckpt("heat tiled", N, N, NUM_ITERS);
+    int first = ckpt.restore([&](int i)
+                             { return grid[i + 1] + 1; });
+    snapshot::Writer snap(N, N);
+    converge::Check check(p.converge, p.converge_norm, p.converge_every, (double)N * N, omp_get_max_threads());
+    perf::Session perf("heat tiled", omp_get_max_threads(), (double)N * N, FLOPS_PER_CELL, BYTES_PER_CELL);
+    double t0 = omp_get_wtime();
+    int last = NUM_ITERS;
+    for (int t = first; t < NUM_ITERS; t++)
+    {
+        bool measure = check.due(t);
+        if (measure)
+            check.reset();
+        perf.begin_step();
+        if (p.skip >= 0)
+            rebuild();
+#pragma omp parallel
+        {
+            trace::Span compute("tiles", "compute", t);
+            perf.start(omp_get_thread_num());
+            converge::Change *change = measure ? &check.part(omp_get_thread_num()) : nullptr;
+            if (p.skip >= 0)
+                sweep_active(grid, new_grid, change);
+            else
+                sweep(grid, new_grid, change);
+            perf.stop(omp_get_thread_num());
+            compute.end();
+
+            // Explicit so the time each thread waits for the slowest one
+            // shows up in the trace.
+            trace::Span wait("barrier", "wait", t);
+#pragma omp barrier
+        }
+        perf.end_step();
 
         double **temp = grid;
         grid = new_grid;
         new_grid = temp;
+        snap.step(t + 1, [&](int i)
+                  { return grid[i + 1] + 1; });
+        ckpt.step(t + 1, [&](int i)
+                  { return grid[i + 1] + 1; });
+        if (measure && check.done(t, check.local(check.gather())))
+        {
+            last = t + 1;
+            break;
+        }
     }
     std::cout << omp_get_wtime() - t0;
+    if (p.skip >= 0 && last > first)
+        std::cerr << "[skip] updated " << 100.0 * updated / ((double)tiles_i * tiles_j * (last - first))
+                  << "% of tiles" << std::endl;
+    perf.report();
+    check.report(NUM_ITERS);
+    write_output(N, N, [&](int i)
+                 { return grid[i + 1] + 1; });
+    ckpt.finish();
     for (int i = 0; i <= N + 1; i++)
     {
         delete[] grid[i];
@@ -73,4 +203,10 @@ int main(int argc, char *argv[])
     delete[] new_grid;
 
     return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return heat::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                        { return simulate(p, argc, argv); });
 }
\ No newline at end of file
@@ -1,3 +1,3 @@
 #!/bin/zsh
-mpicxx ./src/parallel.cpp -o parallel
+mpicxx -I.. -DSIM_MPI ./src/parallel.cpp -o parallel
 mpirun -np $NPROC ./parallel ./input/radioactive_matrix.csv
\ No newline at end of file
@@ -1,3 +1,3 @@
 #!/bin/zsh
-g++-15 ./src/sequential.cpp -o sequential  
+g++-15 -I.. ./src/sequential.cpp -o sequential  
 ./sequential ./input/radioactive_matrix.csv
\ No newline at end of file
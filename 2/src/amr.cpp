@@ -0,0 +1,407 @@
+#include "simulation.h"
+#include <chrono>
+#include <cmath>
+#include <omp.h>
+
+// Block-structured adaptive mesh refinement for the dispersion model:
+//
+//   build/2/amr in.csv --n 4000 --block 32 --ratio 2 --refine-above 1 --regrid 10
+//
+// The base level is the n x n grid of 2/sequential, split into blocks of
+// --block x --block cells. Every block with a cell above --refine-above, or
+// differing from a neighbour by more than --refine-gradient, is covered
+// together with the blocks around it by a fine block of --ratio times the
+// resolution. A step advances the base level with the sequential kernel, then
+// the fine blocks by --substeps (default --ratio) steps of time-step /
+// substeps, their ghost cells taken from neighbouring fine blocks or from the
+// base level interpolated in time. The base cells under a fine block are then
+// replaced by the average of its cells, and the base cells next to one get
+// the difference between the fine and the coarse flux through their shared
+// face (refluxing), so no mass is lost or gained at the level boundary.
+// Blocks are flagged again every --regrid steps; new fine blocks start from
+// the base values. Fine blocks are spread over OpenMP threads.
+//
+// The per-step counts and SIM_OUTPUT are those of the base level, so they
+// compare with the other variants; with nothing refined they are
+// 2/sequential's bit for bit. The other options are those of 2/sequential.
+
+// stencil::Dispersion's update is c - dt / h * (F(c, next) - F(prev, c))
+// per direction, with F the flux from cell a into the following cell b at
+// spacing h.
+inline double flux(double a, double b, double wind, double diffusion, double h)
+{
+    return wind * a - diffusion * (b - a) / h;
+}
+
+struct Block
+{
+    int bi, bj;     // base block
+    int i0, j0;     // first fine row and column, from 0
+    int rows, cols; // fine cells
+    std::vector<double> c, next;
+    // Fine fluxes through the north, south, west and east faces, summed over
+    // the substeps of one step and multiplied by the substep.
+    std::vector<double> flux[4];
+
+    int stride() const { return cols + 2; }
+};
+
+template <typename Params>
+class Mesh
+{
+public:
+    explicit Mesh(const Params &p)
+        : p(p), N(p.n), B(p.block), R(p.ratio), S(p.substeps > 0 ? p.substeps : p.ratio),
+          nb((N + B - 1) / B), W(N + 2), grid((size_t)W * W, 0.0), old(grid), owner(nb * nb, -1) {}
+
+    double *cell(int i, int j) { return &grid[(size_t)i * W + j]; }
+
+    // Advances one step and returns the number of uncontaminated base cells.
+    int step()
+    {
+        std::swap(grid, old);
+        const stencil::Dispersion base(p);
+        const double *g = old.data();
+        double *ng = grid.data();
+#pragma omp parallel for schedule(static)
+        for (int i = 1; i <= N; i++)
+            stencil::row(base, g, ng, W, i, 1, N + 1);
+        updates += (double)N * N;
+        if (!blocks.empty())
+        {
+            advance_fine();
+            restrict_fine();
+            reflux();
+        }
+        fine_area += (double)fine_cells / ((double)N * N * R * R);
+
+        int uncontaminated = 0;
+#pragma omp parallel for schedule(static) reduction(+ : uncontaminated)
+        for (int i = 1; i <= N; i++)
+        {
+            for (int j = 1; j <= N; j++)
+                uncontaminated += ng[(size_t)i * W + j] == 0;
+        }
+        return uncontaminated;
+    }
+
+    // Covers the flagged blocks and their neighbours with fine blocks,
+    // keeping the ones that already exist.
+    void regrid()
+    {
+        std::vector<char> flag(nb * nb, 0);
+#pragma omp parallel for schedule(dynamic)
+        for (int b = 0; b < nb * nb; b++)
+        {
+            int i_end = std::min(N, (b / nb + 1) * B);
+            int j_end = std::min(N, (b % nb + 1) * B);
+            for (int i = b / nb * B; i < i_end && !flag[b]; i++)
+            {
+                for (int j = b % nb * B; j < j_end; j++)
+                {
+                    const double *c = &grid[(size_t)(i + 1) * W + j + 1];
+                    if (c[0] > p.refine_above || (i + 1 < N && std::fabs(c[0] - c[W]) > p.refine_gradient) ||
+                        (j + 1 < N && std::fabs(c[0] - c[1]) > p.refine_gradient))
+                    {
+                        flag[b] = 1;
+                        break;
+                    }
+                }
+            }
+        }
+
+        std::vector<Block> next_blocks;
+        std::vector<int> next_owner(nb * nb, -1);
+        std::vector<int> created;
+        for (int bi = 0; bi < nb; bi++)
+        {
+            for (int bj = 0; bj < nb; bj++)
+            {
+                bool want = false;
+                for (int di = -1; di <= 1; di++)
+                {
+                    for (int dj = -1; dj <= 1; dj++)
+                    {
+                        int i = bi + di, j = bj + dj;
+                        want |= i >= 0 && j >= 0 && i < nb && j < nb && flag[i * nb + j];
+                    }
+                }
+                if (!want)
+                    continue;
+                next_owner[bi * nb + bj] = (int)next_blocks.size();
+                int o_idx = owner[bi * nb + bj];
+                if (o_idx >= 0)
+                {
+                    next_blocks.push_back(std::move(blocks[o_idx]));
+                    continue;
+                }
+                Block b;
+                b.bi = bi;
+                b.bj = bj;
+                b.i0 = bi * B * R;
+                b.j0 = bj * B * R;
+                b.rows = (std::min(N, (bi + 1) * B) - bi * B) * R;
+                b.cols = (std::min(N, (bj + 1) * B) - bj * B) * R;
+                created.push_back((int)next_blocks.size());
+                next_blocks.push_back(std::move(b));
+            }
+        }
+
+        // New blocks take the value of the base cell each fine cell lies in.
+#pragma omp parallel for schedule(dynamic)
+        for (size_t k = 0; k < created.size(); k++)
+        {
+            Block &b = next_blocks[created[k]];
+            int w = b.stride();
+            b.c.assign((size_t)(b.rows + 2) * w, 0.0);
+            b.next = b.c;
+            b.flux[0].assign(b.cols, 0.0);
+            b.flux[1].assign(b.cols, 0.0);
+            b.flux[2].assign(b.rows, 0.0);
+            b.flux[3].assign(b.rows, 0.0);
+            for (int i = 1; i <= b.rows; i++)
+            {
+                for (int j = 1; j <= b.cols; j++)
+                    b.c[(size_t)i * w + j] = grid[(size_t)((b.i0 + i - 1) / R + 1) * W + (b.j0 + j - 1) / R + 1];
+            }
+        }
+        blocks.swap(next_blocks);
+        owner.swap(next_owner);
+        fine_cells = 0;
+        for (const Block &b : blocks)
+            fine_cells += (double)b.rows * b.cols;
+    }
+
+    // Cell updates so far, and their share of a uniform run at the fine
+    // resolution with the same substeps.
+    void report(int steps) const
+    {
+        double uniform = (double)N * N * R * R * S * steps;
+        std::fprintf(stderr, "[amr] ratio %d, %zu fine blocks at the end, %.1f%% of the domain refined on average, "
+                             "%.3g cell updates (%.1f%% of a uniform fine grid)\n",
+                     R, blocks.size(), steps > 0 ? 100.0 * fine_area / steps : 0.0, updates,
+                     steps > 0 ? 100.0 * updates / uniform : 0.0);
+    }
+
+private:
+    const Params &p;
+    const int N, B, R, S;
+    const int nb; // base blocks per side
+    const int W;  // base row stride
+    std::vector<double> grid, old;
+    std::vector<Block> blocks;
+    std::vector<int> owner; // fine block of each base block, or -1
+    double fine_cells = 0;
+    double updates = 0;
+    double fine_area = 0;
+
+    bool refined(int ci, int cj) const { return owner[(ci / B) * nb + cj / B] >= 0; }
+
+    // Fine cell (gi, gj), counted from 0, at fraction frac of the step.
+    double value(int gi, int gj, double frac) const
+    {
+        if (gi < 0 || gj < 0 || gi >= N * R || gj >= N * R)
+            return 0.0;
+        int ci = gi / R, cj = gj / R;
+        int k = owner[(ci / B) * nb + cj / B];
+        if (k >= 0)
+        {
+            const Block &b = blocks[k];
+            return b.c[(size_t)(gi - b.i0 + 1) * b.stride() + gj - b.j0 + 1];
+        }
+        size_t c = (size_t)(ci + 1) * W + cj + 1;
+        return old[c] + frac * (grid[c] - old[c]);
+    }
+
+    void fill_ghosts(Block &b, double frac)
+    {
+        int w = b.stride();
+        for (int j = 1; j <= b.cols; j++)
+        {
+            b.c[j] = value(b.i0 - 1, b.j0 + j - 1, frac);
+            b.c[(size_t)(b.rows + 1) * w + j] = value(b.i0 + b.rows, b.j0 + j - 1, frac);
+        }
+        for (int i = 1; i <= b.rows; i++)
+        {
+            b.c[(size_t)i * w] = value(b.i0 + i - 1, b.j0 - 1, frac);
+            b.c[(size_t)i * w + b.cols + 1] = value(b.i0 + i - 1, b.j0 + b.cols, frac);
+        }
+    }
+
+    void advance_fine()
+    {
+        const double dx = p.dx / R, dy = p.dy / R, dt = p.time_step / S;
+        const stencil::Dispersion fine(p, dx, dy, dt);
+        for (Block &b : blocks)
+        {
+            for (auto &f : b.flux)
+                std::fill(f.begin(), f.end(), 0.0);
+        }
+        for (int s = 0; s < S; s++)
+        {
+            // All ghosts first: they read the neighbours' cells of this
+            // substep.
+#pragma omp parallel for schedule(dynamic)
+            for (size_t k = 0; k < blocks.size(); k++)
+                fill_ghosts(blocks[k], (double)s / S);
+#pragma omp parallel for schedule(dynamic)
+            for (size_t k = 0; k < blocks.size(); k++)
+            {
+                Block &b = blocks[k];
+                const int w = b.stride();
+                const double *c = b.c.data();
+                double *next = b.next.data();
+                for (int i = 1; i <= b.rows; i++)
+                    stencil::row(fine, c, next, w, i, 1, b.cols + 1);
+                for (int j = 1; j <= b.cols; j++)
+                {
+                    b.flux[0][j - 1] += dt * flux(c[j], c[w + j], p.wind_x, p.diffusion, dx);
+                    b.flux[1][j - 1] += dt * flux(c[(size_t)b.rows * w + j], c[(size_t)(b.rows + 1) * w + j], p.wind_x, p.diffusion, dx);
+                }
+                for (int i = 1; i <= b.rows; i++)
+                {
+                    b.flux[2][i - 1] += dt * flux(c[(size_t)i * w], c[(size_t)i * w + 1], p.wind_y, p.diffusion, dy);
+                    b.flux[3][i - 1] += dt * flux(c[(size_t)i * w + b.cols], c[(size_t)i * w + b.cols + 1], p.wind_y, p.diffusion, dy);
+                }
+                std::swap(b.c, b.next);
+            }
+            updates += fine_cells;
+        }
+    }
+
+    // Base cells under a fine block become the average of its cells.
+    void restrict_fine()
+    {
+#pragma omp parallel for schedule(dynamic)
+        for (size_t k = 0; k < blocks.size(); k++)
+        {
+            const Block &b = blocks[k];
+            const int w = b.stride();
+            for (int ci = 0; ci < b.rows / R; ci++)
+            {
+                for (int cj = 0; cj < b.cols / R; cj++)
+                {
+                    double sum = 0;
+                    for (int a = 0; a < R; a++)
+                    {
+                        for (int c = 0; c < R; c++)
+                            sum += b.c[(size_t)(ci * R + a + 1) * w + cj * R + c + 1];
+                    }
+                    grid[(size_t)(b.i0 / R + ci + 1) * W + b.j0 / R + cj + 1] = sum / (R * R);
+                }
+            }
+        }
+    }
+
+    // Replaces, in each unrefined base cell next to a fine block, the coarse
+    // flux through the shared face by the average of the fine ones. Serial: a
+    // corner cell may border two blocks.
+    void reflux()
+    {
+        const double dt = p.time_step;
+        auto fine = [&](const std::vector<double> &f, int k)
+        {
+            double sum = 0;
+            for (int a = 0; a < R; a++)
+                sum += f[k * R + a];
+            return sum / R;
+        };
+        auto correct = [&](size_t c, double delta)
+        { grid[c] = std::max(0.0, grid[c] + delta); };
+        for (const Block &b : blocks)
+        {
+            const int ci0 = b.i0 / R, cj0 = b.j0 / R; // first base row and column, from 0
+            const int rows = b.rows / R, cols = b.cols / R;
+            for (int k = 0; k < cols; k++)
+            {
+                int cj = cj0 + k;
+                if (ci0 > 0 && !refined(ci0 - 1, cj))
+                {
+                    size_t out = (size_t)ci0 * W + cj + 1, in = out + W;
+                    correct(out, -(fine(b.flux[0], k) - dt * flux(old[out], old[in], p.wind_x, p.diffusion, p.dx)) / p.dx);
+                }
+                if (ci0 + rows < N && !refined(ci0 + rows, cj))
+                {
+                    size_t in = (size_t)(ci0 + rows) * W + cj + 1, out = in + W;
+                    correct(out, (fine(b.flux[1], k) - dt * flux(old[in], old[out], p.wind_x, p.diffusion, p.dx)) / p.dx);
+                }
+            }
+            for (int k = 0; k < rows; k++)
+            {
+                int ci = ci0 + k;
+                if (cj0 > 0 && !refined(ci, cj0 - 1))
+                {
+                    size_t out = (size_t)(ci + 1) * W + cj0, in = out + 1;
+                    correct(out, -(fine(b.flux[2], k) - dt * flux(old[out], old[in], p.wind_y, p.diffusion, p.dy)) / p.dy);
+                }
+                if (cj0 + cols < N && !refined(ci, cj0 + cols))
+                {
+                    size_t in = (size_t)(ci + 1) * W + cj0 + cols, out = in + 1;
+                    correct(out, (fine(b.flux[3], k) - dt * flux(old[in], old[out], p.wind_y, p.diffusion, p.dy)) / p.dy);
+                }
+            }
+        }
+    }
+};
+
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.csv [--block b] [--ratio r] [--refine-above c] ..." << std::endl;
+        return 1;
+    }
+
+    const int N = p.n;
+    const int SIMULATION_STEPS = p.steps;
+    Mesh<Params> mesh(p);
+
+    std::ifstream file(argv[1]);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open file " << argv[1] << std::endl;
+        return 1;
+    }
+    std::string line;
+    for (int i = 1; i <= N; i++)
+    {
+        if (!std::getline(file, line))
+        {
+            return 1;
+        }
+        std::istringstream ss(line);
+        for (int j = 1; j <= N; j++)
+        {
+            std::string token;
+            if (!std::getline(ss, token, ','))
+            {
+                return 1;
+            }
+            *mesh.cell(i, j) = std::stod(token);
+        }
+    }
+    file.close();
+
+    auto start = std::chrono::steady_clock::now();
+    mesh.regrid();
+    for (int t = 0; t < SIMULATION_STEPS; t++)
+    {
+        int uncontaminated = mesh.step();
+        if ((t + 1) % p.regrid == 0)
+            mesh.regrid();
+        std::cout << uncontaminated << std::endl;
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "AMR: " << std::chrono::duration<double>(end - start).count();
+    mesh.report(SIMULATION_STEPS);
+    write_output(N, N, [&](int i)
+                 { return mesh.cell(i + 1, 1); });
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return dispersion::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                              { return simulate(p, argc, argv); });
+}
@@ -0,0 +1,156 @@
+#include "simulation.h"
+#include <chrono>
+#include <omp.h>
+
+// Many runs of the dispersion model over one initial field, advanced
+// together:
+//
+//   build/2/ensemble in.csv --wind-x 3.3,5,8 --wind-y 1.4,1.4,0 --decay 3e-5
+//
+// --wind-x, --wind-y, --diffusion, --decay and --deposition take one value
+// per member or a single value for all of them; --n, --time, --time-step,
+// --dx and --dy are shared. Each cell stores the members next to each other,
+// so the member loop is unit-stride and vectorizes with per-member
+// coefficients (stencil::DispersionLanes), and the stencil addressing, loop
+// overhead and input reading are paid once for the whole ensemble. Every
+// step prints one line with the members' uncontaminated counts; SIM_OUTPUT
+// gets the members' final fields one after another, each as 2/sequential
+// writes it.
+
+// One step over all members; returns the per-lane uncontaminated counts in
+// counts. MP is the lane count when it is a compile-time constant, 0
+// otherwise.
+template <int MP>
+void sweep(const double *g, double *ng, int *counts, const stencil::DispersionLanes &s, int N)
+{
+    const size_t ROW = (size_t)(N + 2) * s.lanes;
+    std::fill(counts, counts + s.lanes, 0);
+#pragma omp parallel
+    {
+        std::vector<int> local(s.lanes, 0);
+#pragma omp for schedule(static)
+        for (int i = 1; i <= N; i++)
+            stencil::row<MP>(s, g + (i - 1) * ROW, g + i * ROW, g + (i + 1) * ROW, ng + i * ROW, 1, N + 1, local.data());
+#pragma omp critical
+        for (int m = 0; m < s.lanes; m++)
+            counts[m] += local[m];
+    }
+}
+
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.csv [--wind-x a,b,...] ..." << std::endl;
+        return 1;
+    }
+
+    const int N = p.n;
+    const int SIMULATION_STEPS = p.steps;
+    const int M = (int)p.members.size();
+    const stencil::DispersionLanes lanes(p, p.members);
+    const int MP = lanes.lanes;
+    const int W = N + 2;
+
+    // Cell (i, j) of member m is grid[(i * W + j) * MP + m], with a ring of
+    // zero cells around the field as in the sequential version.
+    size_t cells = (size_t)W * W * MP;
+    std::vector<double> grid(cells, stencil::DispersionLanes::BOUNDARY), new_grid(cells, stencil::DispersionLanes::BOUNDARY);
+
+    std::ifstream file(argv[1]);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open file " << argv[1] << std::endl;
+        return 1;
+    }
+    std::string line;
+    for (int i = 1; i <= N; i++)
+    {
+        if (!std::getline(file, line))
+        {
+            return 1;
+        }
+        std::istringstream ss(line);
+        for (int j = 1; j <= N; j++)
+        {
+            std::string token;
+            if (!std::getline(ss, token, ','))
+            {
+                return 1;
+            }
+            double v = std::stod(token);
+            double *cell = &grid[((size_t)i * W + j) * MP];
+            for (int m = 0; m < MP; m++)
+                cell[m] = v;
+        }
+    }
+    file.close();
+
+    auto step = &sweep<0>;
+    switch (MP)
+    {
+    case 4:
+        step = &sweep<4>;
+        break;
+    case 8:
+        step = &sweep<8>;
+        break;
+    case 16:
+        step = &sweep<16>;
+        break;
+    case 32:
+        step = &sweep<32>;
+        break;
+    }
+
+    std::vector<int> counts(MP);
+    std::ostringstream out;
+    perf::Session perf("dispersion ensemble", 1, (double)N * N * M, FLOPS_PER_CELL, BYTES_PER_CELL);
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < SIMULATION_STEPS; t++)
+    {
+        perf.begin_step();
+        perf.start(0);
+        step(grid.data(), new_grid.data(), counts.data(), lanes, N);
+        perf.stop(0);
+        perf.end_step();
+        std::swap(grid, new_grid);
+        for (int m = 0; m < M; m++)
+            out << (m ? "," : "") << counts[m];
+        out << '\n';
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << out.str();
+    std::cout << "Ensemble: " << std::chrono::duration<double>(end - start).count();
+    perf.report();
+
+    const char *path = std::getenv("SIM_OUTPUT");
+    if (path != nullptr)
+    {
+        std::FILE *f = std::fopen(path, "wb");
+        if (f == nullptr)
+        {
+            std::fprintf(stderr, "Failed to open output %s\n", path);
+            return 0;
+        }
+        std::vector<double> row(N);
+        for (int m = 0; m < M; m++)
+        {
+            for (int i = 1; i <= N; i++)
+            {
+                for (int j = 1; j <= N; j++)
+                    row[j - 1] = grid[((size_t)i * W + j) * MP + m];
+                std::fwrite(row.data(), sizeof(double), N, f);
+            }
+        }
+        std::fclose(f);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return dispersion::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                              { return simulate(p, argc, argv); }, true);
+}
@@ -0,0 +1,45 @@
+#include "simulation.h"
+#include "shared/outofcore.h"
+#include <chrono>
+
+// The dispersion model on a grid kept on disk; see shared/outofcore.h. The
+// counts of a pass's steps are printed when the pass ends.
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
+{
+    const int N = p.n;
+    const int SIMULATION_STEPS = p.steps;
+    const stencil::Dispersion dispersion(p);
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.csv|input.bin [--band rows] [--fuse steps]" << std::endl;
+        return 1;
+    }
+
+    ooc::Store store(N);
+    if (store.fd < 0)
+        return 1;
+    ooc::Reader input = store.input(argv[1], N);
+    if (!input)
+    {
+        std::cerr << "Failed to open file " << argv[1] << std::endl;
+        return 1;
+    }
+    auto row = [&](const double *up, const double *mid, const double *down, double *out)
+    {
+        return stencil::row(dispersion, up, mid, down, out, 1, N + 1);
+    };
+    auto start = std::chrono::steady_clock::now();
+    if (!ooc::run(input, store, N, SIMULATION_STEPS, p.band, p.fuse, stencil::Dispersion::BOUNDARY, row, [](int, long long count)
+                  { std::cout << count << std::endl; }))
+        return 1;
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Out-of-core: " << std::chrono::duration<double>(end - start).count();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return dispersion::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                              { return simulate(p, argc, argv); });
+}
@@ -1,8 +1,19 @@
 #include "simulation.h"
 #include <chrono>
 
-int main(int argc, char *argv[])
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
 {
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.csv [--n n] [--time t] ..." << std::endl;
+        return 1;
+    }
+
+    const int N = p.n;
+    const int SIMULATION_STEPS = p.steps;
+    const stencil::Dispersion dispersion(p);
+
     double **grid = new double *[N + 2];
     double **new_grid = new double *[N + 2];
     for (int i = 0; i <= N + 1; i++)
@@ -11,67 +22,113 @@ int main(int argc, char *argv[])
         new_grid[i] = new double[N + 2];
         for (int j = 0; j <= N + 1; j++)
         {
-            grid[i][j] = 0.0;
-            new_grid[i][j] = 0.0;
+            grid[i][j] = stencil::Dispersion::BOUNDARY;
+            new_grid[i][j] = stencil::Dispersion::BOUNDARY;
         }
     }
+    auto release = [&]()
+    {
+        for (int i = 0; i <= N + 1; i++)
+        {
+            delete[] grid[i];
+            delete[] new_grid[i];
+        }
+        delete[] grid;
+        delete[] new_grid;
+    };
 
-    std::ifstream file(argv[1]);
-    if (!file.is_open())
+    checkpoint::State ckpt("dispersion sequential", N, N, SIMULATION_STEPS);
+    ingest::Reader input;
+    if (ingest::enabled() && !ckpt.enabled())
     {
-        std::cerr << "Failed to open file " << argv[1] << std::endl;
-        return 1;
+        input.start(argv[1], N, N, [rows = grid](int i)
+                    { return rows[i + 1] + 1; });
     }
-    std::string line;
-    for (int i = 1; i <= N; i++)
+    else
     {
-        if (!std::getline(file, line))
+        std::ifstream file(argv[1]);
+        if (!file.is_open())
         {
+            std::cerr << "Failed to open file " << argv[1] << std::endl;
+            release();
             return 1;
         }
-        std::istringstream ss(line);
-        for (int j = 1; j <= N; j++)
+        std::string line;
+        for (int i = 1; i <= N; i++)
         {
-            std::string token;
-            if (!std::getline(ss, token, ','))
+            if (!std::getline(file, line))
             {
+                release();
                 return 1;
             }
-            grid[i][j] = std::stod(token);
+            std::istringstream ss(line);
+            for (int j = 1; j <= N; j++)
+            {
+                std::string token;
+                if (!std::getline(ss, token, ','))
+                {
+                    release();
+                    return 1;
+                }
+                grid[i][j] = std::stod(token);
+            }
         }
-    }
 
-    file.close();
-    auto start = std::chrono::high_resolution_clock::now();
-    for (int t = 0; t < SIMULATION_STEPS; t++)
+        file.close();
+    }
+    int first = ckpt.restore([&](int i)
+                             { return grid[i + 1] + 1; });
+    snapshot::Writer snap(N, N);
+    metrics::Set stats(N, p.dx * p.dy);
+    perf::Session perf("dispersion sequential", 1, (double)N * N, FLOPS_PER_CELL, BYTES_PER_CELL);
+    auto start = std::chrono::steady_clock::now();
+    for (int t = first; t < SIMULATION_STEPS; t++)
     {
         int total_uncontaminated = 0;
+        metrics::Partial part;
+        perf.begin_step();
+        perf.start(0);
 
         for (int i = 1; i <= N; i++)
         {
-            for (int j = 1; j <= N; j++)
+            if (input.active() && !input.wait(std::min(i + 1, N)))
             {
-                double advection = WIND_X * (grid[i][j] - grid[i - 1][j]) / DX + WIND_Y * (grid[i][j] - grid[i][j - 1]) / DY;
-                double diffusion = DIFFUSION_COEFF * (grid[i + 1][j] - 2 * grid[i][j] + grid[i - 1][j]) / (DX * DX) + DIFFUSION_COEFF * (grid[i][j + 1] - 2 * grid[i][j] + grid[i][j - 1]) / (DY * DY);
-                double decay = DECAY_RATE * grid[i][j] + DEPOSITION_RATE * grid[i][j];
-                new_grid[i][j] = grid[i][j] + TIME_STEP * (-advection + diffusion - decay);
-                new_grid[i][j] = std::max(0.0, new_grid[i][j]);
-
-                if (new_grid[i][j] == 0)
-                    total_uncontaminated++;
+                input.finish();
+                release();
+                return 1;
             }
+            total_uncontaminated += stencil::row(dispersion, grid[i - 1], grid[i], grid[i + 1], new_grid[i], 1, N + 1);
+            stats.add(part, new_grid[i] + 1, N, i - 1, 0);
         }
+        input.finish();
+        perf.stop(0);
+        perf.end_step();
         std::swap(grid, new_grid);
+        stats.write(t + 1, part);
+        snap.step(t + 1, [&](int i)
+                  { return grid[i + 1] + 1; });
+        ckpt.step(t + 1, [&](int i)
+                  { return grid[i + 1] + 1; });
         std::cout << total_uncontaminated << std::endl;
     }
-    auto end = std::chrono::high_resolution_clock::now();
-    std::cout << "Sequential: " << std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
-
-    for (int i = 0; i <= N + 1; i++)
+    if (!input.finish())
     {
-        delete[] grid[i];
+        release();
+        return 1;
     }
-    delete[] grid;
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Sequential: " << std::chrono::duration<double>(end - start).count();
+    perf.report();
+    write_output(N, N, [&](int i)
+                 { return grid[i + 1] + 1; });
+    ckpt.finish();
+    release();
 
     return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return dispersion::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                              { return simulate(p, argc, argv); });
 }
\ No newline at end of file
@@ -1,3 +1,3 @@
 #!/bin/zsh
-g++-15 src/threadpool.cpp -o threadpool
+g++-15 -I.. src/threadpool.cpp -o threadpool
 ./threadpool
\ No newline at end of file
@@ -1,10 +1,6 @@
 #include <iostream>
 #include <cmath>
-
-constexpr int TIME = 100;
-constexpr int N = 4000;
-constexpr long W = 5000000000;
-
-const int CENTER_X = N / 2;
-const int CENTER_Y = N / 2;
-constexpr int CELL_SIZE = 10;
\ No newline at end of file
+#include "shared/output.h"
+#include "shared/params.h"
+#include "shared/snapshot.h"
+#include "shared/trace.h"
@@ -6,15 +6,27 @@ int sq(int x)
     return x * x;
 }
 
-int main(int argc, char *argv[])
+int simulate(const shock::Params &p, int, char *[])
 {
+    const int N = p.n;
+    const int TIME = p.time;
+    const double W = p.yield;
+    const double CELL_SIZE = p.cell_size;
+    const int CENTER_X = N / 2;
+    const int CENTER_Y = N / 2;
     const double c[9] = {2.611369, -1.690128, 0.00805, 0.336743, -0.005162, -0.080923, -0.004785, 0.007930, 0.000768};
+
     double **grid = new double *[N];
     for (int i = 0; i < N; i++)
     {
         grid[i] = new double[N];
+        for (int j = 0; j < N; j++)
+        {
+            grid[i][j] = 0.0;
+        }
     }
-    auto start = std::chrono::high_resolution_clock::now();
+    snapshot::Writer snap(N, N);
+    auto start = std::chrono::steady_clock::now();
     for (int t = 0; t < TIME; t++)
     {
         for (int i = 0; i < N; i++)
@@ -25,23 +37,33 @@ int main(int argc, char *argv[])
 
                 if (t >= R / 343.0)
                 {
-                    double Z = R * pow(W, -1 / 3);
+                    double Z = R * pow(W, -1.0 / 3.0);
                     double U = -0.21436 + 1.35034 * log10(Z);
                     double log10P = 0.0;
-                    for (int i = 0; i < 9; i++)
+                    for (int k = 0; k < 9; k++)
                     {
-                        log10P += c[i] * pow(U, i);
+                        log10P += c[k] * pow(U, k);
                     }
-                    grid[i][j] = pow(log10P, 10);
+                    grid[i][j] = pow(10.0, log10P);
                 }
             }
         }
+        snap.step(t + 1, [&](int i)
+                  { return grid[i]; });
     }
-    auto end = std::chrono::high_resolution_clock::now();
-    std::cout << std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
+    auto end = std::chrono::steady_clock::now();
+    std::cout << std::chrono::duration<double>(end - start).count();
+    write_output(N, N, [&](int i)
+                 { return grid[i]; });
     for (int i = 0; i < N; i++)
     {
         delete[] grid[i];
     }
+    delete[] grid;
     return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return shock::launch(argc, argv, simulate);
 }
\ No newline at end of file
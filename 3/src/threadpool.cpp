@@ -5,6 +5,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <vector>
+#include <cstdlib>
 
 #define NUM_THREADS 4
 
@@ -18,8 +19,9 @@ struct Task
     int t;
     double **grid;
     const double *c;
+    const shock::Params *p;
 
-    Task(int time, double **g, const double *coeffs) : t(time), grid(g), c(coeffs) {}
+    Task(int time, double **g, const double *coeffs, const shock::Params *params) : t(time), grid(g), c(coeffs), p(params) {}
 };
 
 class TaskQueue
@@ -76,19 +78,30 @@ private:
     std::thread t;
     TaskQueue *taskQueue;
 
-    void run()
+    void run(int id)
     {
+        trace::name_thread("worker " + std::to_string(id));
         while (true)
         {
-            Task *task = taskQueue->dequeue();
+            Task *task;
+            {
+                trace::Span span("dequeue", "wait");
+                task = taskQueue->dequeue();
+            }
             if (task == nullptr)
             {
                 break;
             }
+            trace::Span span("step", "compute", task->t);
 
             int t = task->t;
             double **grid = task->grid;
             const double *c = task->c;
+            const int N = task->p->n;
+            const double W = task->p->yield;
+            const double CELL_SIZE = task->p->cell_size;
+            const int CENTER_X = N / 2;
+            const int CENTER_Y = N / 2;
 
             for (int i = 0; i < N; i++)
             {
@@ -115,9 +128,9 @@ private:
     }
 
 public:
-    Worker(TaskQueue *tq) : taskQueue(tq)
+    Worker(TaskQueue *tq, int id) : taskQueue(tq)
     {
-        t = std::thread(&Worker::run, this);
+        t = std::thread(&Worker::run, this, id);
     }
 
     void join()
@@ -129,10 +142,26 @@ public:
     }
 };
 
-int main(int argc, char *argv[])
+int simulate(const shock::Params &p, int argc, char *argv[])
 {
+    const int N = p.n;
+    const int TIME = p.time;
     const double c[9] = {2.611369, -1.690128, 0.00805, 0.336743, -0.005162, -0.080923, -0.004785, 0.007930, 0.000768};
 
+    // Worker count can be given as the first argument.
+    int num_threads = NUM_THREADS;
+    if (argc > 1)
+    {
+        char *end = nullptr;
+        long v = std::strtol(argv[1], &end, 10);
+        if (end == argv[1] || *end != '\0' || v < 1 || v > 4096)
+        {
+            std::cerr << "Usage: " << argv[0] << " [threads] [--n n] [--time t], threads from 1 to 4096" << std::endl;
+            return 1;
+        }
+        num_threads = (int)v;
+    }
+
     // Allocate grid
     double **grid = new double *[N];
     for (int i = 0; i < N; i++)
@@ -147,32 +176,41 @@ int main(int argc, char *argv[])
     TaskQueue taskQueue;
     std::vector<Worker *> workers;
 
-    for (int i = 0; i < NUM_THREADS; i++)
+    for (int i = 0; i < num_threads; i++)
     {
-        workers.push_back(new Worker(&taskQueue));
+        workers.push_back(new Worker(&taskQueue, i));
     }
 
-    auto start = std::chrono::high_resolution_clock::now();
+    auto start = std::chrono::steady_clock::now();
 
     for (int t = 0; t < TIME; t++)
     {
-        taskQueue.enqueue(new Task(t, grid, c));
+        taskQueue.enqueue(new Task(t, grid, c, &p));
     }
 
-    while (!taskQueue.is_empty())
+    trace::name_thread("main");
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        trace::Span span("drain queue", "wait");
+        while (!taskQueue.is_empty())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
     }
 
     taskQueue.stop();
-    for (Worker *worker : workers)
     {
-        worker->join();
-        delete worker;
+        trace::Span span("join workers", "wait");
+        for (Worker *worker : workers)
+        {
+            worker->join();
+            delete worker;
+        }
     }
 
-    auto end = std::chrono::high_resolution_clock::now();
-    std::cout << std::chrono::duration_cast<std::chrono::seconds>(end - start).count() << std::endl;
+    auto end = std::chrono::steady_clock::now();
+    std::cout << std::chrono::duration<double>(end - start).count() << std::endl;
+    write_output(N, N, [&](int i)
+                 { return grid[i]; });
 
     for (int i = 0; i < N; i++)
     {
@@ -181,4 +219,9 @@ int main(int argc, char *argv[])
     delete[] grid;
 
     return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return shock::launch(argc, argv, simulate);
 }
\ No newline at end of file
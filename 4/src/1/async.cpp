@@ -1,20 +1,28 @@
 #include "common.h"
 
-int main(int argc, char *argv[])
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
 {
+    const int N = p.n;
+    const int NUM_ITERS = p.steps;
 
     MPI_Init(&argc, &argv);
     double t0 = MPI_Wtime();
     int rank = -1, size = 0;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    trace::set_rank(rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
-    double k[3][3] = {
-        {0.05, 0.1, 0.05},
-        {0.1, 0.4, 0.1},
-        {0.05, 0.1, 0.05},
-    };
-    double *grid = new double[N * N];
-    if (rank == 0)
+    if (N < size)
+    {
+        if (rank == 0)
+            std::cerr << "Need at least one grid row per rank" << std::endl;
+        MPI_Finalize();
+        return 1;
+    }
+    const stencil::Heat heat(p);
+    double *grid = new double[(size_t)N * N];
+    const bool pipelined = ingest::enabled();
+    if (rank == 0 && !pipelined)
     {
         std::ifstream file(argv[1]);
         if (!file.is_open())
@@ -37,109 +45,125 @@ int main(int argc, char *argv[])
                 {
                     return 1;
                 }
-                grid[i * N + j] = std::stod(token);
+                grid[(size_t)i * N + j] = std::stod(token);
             }
         }
         file.close();
     }
 
-    int chunk = (N / size) * N;
-    double *local = new double[chunk];
-    double *temp = new double[chunk];
+    // The first N % size ranks take one extra row.
+    int rows = block_rows(N, size, rank);
+    int chunk = rows * N;
+    std::vector<int> sendcounts, displs;
+    block_counts(N, size, N, sendcounts, displs);
+    double *recv = new double[chunk];
 
-    MPI_Scatter((rank == 0 ? grid : nullptr), chunk, MPI_DOUBLE, local, chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (!pipelined)
+    {
+        trace::Span span("MPI_Scatterv", "comm");
+        MPI_Scatterv((rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, recv, chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
 
+    // The slab is padded with a halo row above and below (received from the
+    // neighbours, or left at the boundary value on the outer ranks) and a
+    // boundary column on each side, so the stencil needs no branches.
+    const int W = N + 2;
+    double *local = new double[(size_t)(rows + 2) * W];
+    double *temp = new double[(size_t)(rows + 2) * W];
+    std::fill(local, local + (size_t)(rows + 2) * W, stencil::Heat::BOUNDARY);
+    std::fill(temp, temp + (size_t)(rows + 2) * W, stencil::Heat::BOUNDARY);
+    ingest::Scatter input;
+    if (pipelined)
+    {
+        input.start(argv[1], grid, N, N, rank, size, [slab = local, W](int i)
+                    { return slab + (size_t)(i + 1) * W + 1; });
+    }
+    else
+    {
+        for (int i = 0; i < rows; i++)
+            std::copy(recv + (size_t)i * N, recv + (size_t)(i + 1) * N, local + (size_t)(i + 1) * W + 1);
+    }
+
+    snapshot::Writer snap(N, N, block_start(N, size, rank), rows, rank);
+    converge::Check check(p.converge, p.converge_norm, p.converge_every, (double)N * N);
+    MPI_Pcontrol(1);
     for (int t = 0; t < NUM_ITERS; t++)
     {
         MPI_Request req[4];
         int req_count = 0;
-        double *prev = new double[N];
-        double *next = new double[N];
-        if (rank != 0)
-            MPI_Irecv(prev, N, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &req[req_count++]);
-        if (rank != size - 1)
-            MPI_Irecv(next, N, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &req[req_count++]);
-
-        if (rank != 0)
-            MPI_Isend(local, N, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &req[req_count++]);
-        if (rank != size - 1)
-            MPI_Isend(&local[(N / size - 1) * N], N, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &req[req_count++]);
-
-        MPI_Waitall(req_count, req, MPI_STATUSES_IGNORE);
-        for (int i = 0; i < N / size; i++)
+        bool measure = check.due(t);
+        converge::Change change;
+        // The first step of a pipelined run exchanges halos as the rows
+        // arrive (ingest::Scatter::before_row).
+        if (!input.active())
         {
-            for (int j = 0; j < N; j++)
-            {
-                double n, s, ne, nw, se, sw;
-                if (i > 0)
-                {
-                    n = local[(i - 1) * N + j];
-                }
-                else
-                {
-                    n = (rank != 0) ? prev[j] : 30.0;
-                }
-
-                if (i < N / size - 1)
-                {
-                    s = local[(i + 1) * N + j];
-                }
-                else
-                {
-                    s = (rank != size - 1) ? next[j] : 30.0;
-                }
-
-                if (i > 0 && j > 0)
-                {
-                    nw = local[(i - 1) * N + (j - 1)];
-                }
-                else
-                {
-                    nw = (rank != 0 && j > 0) ? prev[j - 1] : 30.0;
-                }
+            if (rank != 0)
+                MPI_Irecv(&local[1], N, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+            if (rank != size - 1)
+                MPI_Irecv(&local[(size_t)(rows + 1) * W + 1], N, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &req[req_count++]);
 
-                if (i > 0 && j < N - 1)
-                {
-                    ne = local[(i - 1) * N + (j + 1)];
-                }
-                else
-                {
-                    ne = (rank != 0 && j < N - 1) ? prev[j + 1] : 30.0;
-                }
+            if (rank != 0)
+                MPI_Isend(&local[W + 1], N, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+            if (rank != size - 1)
+                MPI_Isend(&local[(size_t)rows * W + 1], N, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &req[req_count++]);
 
-                if (i < N / size - 1 && j > 0)
-                {
-                    sw = local[(i + 1) * N + (j - 1)];
-                }
-                else
-                {
-                    sw = (rank != size - 1 && j > 0) ? next[j - 1] : 30.0;
-                }
-
-                if (i < N / size - 1 && j < N - 1)
-                {
-                    se = local[(i + 1) * N + (j + 1)];
-                }
-                else
-                {
-                    se = (rank != size - 1 && j < N - 1) ? next[j + 1] : 30.0;
-                }
-
-                double w = (j > 0) ? local[i * N + j - 1] : 30.0;
-                double e = (j < N - 1) ? local[i * N + j + 1] : 30.0;
-                temp[i * N + j] = nw * k[0][0] + n * k[0][1] + ne * k[0][2] + w * k[1][0] + local[i * N + j] * k[1][1] + e * k[1][2] + sw * k[2][0] + s * k[2][1] + se * k[2][2];
+            {
+                trace::Span span("MPI_Waitall", "wait", t);
+                MPI_Waitall(req_count, req, MPI_STATUSES_IGNORE);
             }
         }
+        trace::Span compute("compute", "compute", t);
+        for (int i = 1; i <= rows; i++)
+        {
+            if (input.active())
+                input.before_row(local, W, i);
+            stencil::row(heat, local, temp, W, i, 1, N + 1);
+            if (measure)
+                change.add(temp + (size_t)i * W + 1, local + (size_t)i * W + 1, N);
+        }
+        compute.end();
+        input.finish();
 
-        delete[] prev;
-        delete[] next;
         std::swap(local, temp);
+        snap.step(t + 1, [&](int i)
+                  { return local + (size_t)(i + 1) * W + 1; });
+        if (measure)
+        {
+            // Every rank gets the same value, so they all stop together.
+            double value = check.local(change);
+            {
+                trace::Span span("MPI_Allreduce", "comm", t);
+                MPI_Allreduce(MPI_IN_PLACE, &value, 1, MPI_DOUBLE, check.sums() ? MPI_SUM : MPI_MAX, MPI_COMM_WORLD);
+            }
+            if (check.done(t, value))
+                break;
+        }
+    }
+    input.finish();
+    MPI_Pcontrol(2);
+    if (rank == 0)
+        check.report(NUM_ITERS);
+    for (int i = 0; i < rows; i++)
+        std::copy(local + (size_t)(i + 1) * W + 1, local + (size_t)(i + 1) * W + 1 + N, recv + (size_t)i * N);
+    {
+        trace::Span span("MPI_Gatherv", "comm");
+        MPI_Gatherv(recv, chunk, MPI_DOUBLE, (rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
     }
-    MPI_Gather(local, chunk, MPI_DOUBLE, (rank == 0 ? grid : nullptr), chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
+    if (rank == 0)
+        write_output(grid, N, N);
     delete[] grid;
+    delete[] recv;
+    delete[] local;
+    delete[] temp;
     if (rank == 0)
         std::cout << "Parallel: " << MPI_Wtime() - t0;
     MPI_Finalize();
     return 0;
 }
+
+int main(int argc, char *argv[])
+{
+    return heat::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                        { return simulate(p, argc, argv); });
+}
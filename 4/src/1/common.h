@@ -2,8 +2,13 @@
 #include <fstream>
 #include <sstream>
 #include <mpi.h>
+#include "shared/converge.h"
+#include "shared/ingest_mpi.h"
+#include "shared/output.h"
+#include "shared/params.h"
+#include "shared/snapshot.h"
+#include "shared/stencil.h"
+#include "shared/partition.h"
+#include "shared/trace.h"
 
-constexpr int N = 4000;
-constexpr int NUM_ITERS = 100;
-
-bool read_file(double **, char *);
\ No newline at end of file
+bool read_file(double **, char *, int n);
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "common.h"
+#include "shared/coro.h"
+
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
+{
+    const int N = p.n;
+    const int NUM_ITERS = p.steps;
+
+    MPI_Init(&argc, &argv);
+    double t0 = MPI_Wtime();
+    int rank = -1, size = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    trace::set_rank(rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (N < size)
+    {
+        if (rank == 0)
+            std::cerr << "Need at least one grid row per rank" << std::endl;
+        MPI_Finalize();
+        return 1;
+    }
+    const stencil::Heat heat(p);
+    double *grid = new double[(size_t)N * N];
+    if (rank == 0)
+    {
+        std::ifstream file(argv[1]);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open file " << argv[1] << std::endl;
+            return 1;
+        }
+        std::string line;
+        for (int i = 0; i < N; i++)
+        {
+            if (!std::getline(file, line))
+            {
+                return 1;
+            }
+            std::istringstream ss(line);
+            for (int j = 0; j < N; j++)
+            {
+                std::string token;
+                if (!std::getline(ss, token, ','))
+                {
+                    return 1;
+                }
+                grid[(size_t)i * N + j] = std::stod(token);
+            }
+        }
+        file.close();
+    }
+
+    // The first N % size ranks take one extra row.
+    int rows = block_rows(N, size, rank);
+    int chunk = rows * N;
+    std::vector<int> sendcounts, displs;
+    block_counts(N, size, N, sendcounts, displs);
+    double *local = new double[chunk];
+
+    {
+        trace::Span span("MPI_Scatterv", "comm");
+        MPI_Scatterv((rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, local, chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    // The rank's rows as strips advanced by their own coroutines; see
+    // shared/coro.h.
+    std::vector<coro::Strip> strips = coro::split(N, N, size, rank, p.subdomains, stencil::Heat::BOUNDARY);
+    int base = block_start(N, size, rank);
+    for (auto &s : strips)
+    {
+        for (int i = 0; i < s.rows; i++)
+            std::copy(local + (size_t)(s.first - base + i) * N, local + (size_t)(s.first - base + i + 1) * N, s.row(i));
+    }
+    const int W = N + 2;
+    auto row = [heat, N, W](const double *cur, double *next, int i)
+    {
+        return stencil::row(heat, cur, next, W, i, 1, N + 1);
+    };
+
+    MPI_Pcontrol(1);
+    {
+        coro::Scheduler sched;
+        for (auto &s : strips)
+            sched.spawn(coro::advance(sched, s, NUM_ITERS, row, [](int, long long) {}));
+        sched.run();
+    }
+    MPI_Pcontrol(2);
+
+    for (auto &s : strips)
+    {
+        for (int i = 0; i < s.rows; i++)
+            std::copy(s.row(i), s.row(i) + N, local + (size_t)(s.first - base + i) * N);
+    }
+    {
+        trace::Span span("MPI_Gatherv", "comm");
+        MPI_Gatherv(local, chunk, MPI_DOUBLE, (rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    if (rank == 0)
+        write_output(grid, N, N);
+    delete[] grid;
+    delete[] local;
+    if (rank == 0)
+        std::cout << "Coroutines (" << strips.size() << " strips/rank): " << MPI_Wtime() - t0;
+    MPI_Finalize();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return heat::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                        { return simulate(p, argc, argv); });
+}
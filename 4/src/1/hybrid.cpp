@@ -0,0 +1,220 @@
+#include "common.h"
+#include <omp.h>
+
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
+{
+    const int N = p.n;
+    const int NUM_ITERS = p.steps;
+    const int TILE_I = p.tile_i;
+    const int TILE_J = p.tile_j;
+
+    // Only the master thread talks to MPI, the OpenMP team just computes.
+    int provided = 0;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    double t0 = MPI_Wtime();
+    int rank = -1, size = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    trace::set_rank(rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (N < size)
+    {
+        if (rank == 0)
+            std::cerr << "Need at least one grid row per rank" << std::endl;
+        MPI_Finalize();
+        return 1;
+    }
+    if (provided < MPI_THREAD_FUNNELED)
+    {
+        if (rank == 0)
+            std::cerr << "MPI library does not support MPI_THREAD_FUNNELED" << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    const stencil::Heat heat(p);
+    double *grid = new double[(size_t)N * N];
+    if (rank == 0)
+    {
+        std::ifstream file(argv[1]);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open file " << argv[1] << std::endl;
+            return 1;
+        }
+        std::string line;
+        for (int i = 0; i < N; i++)
+        {
+            if (!std::getline(file, line))
+            {
+                return 1;
+            }
+            std::istringstream ss(line);
+            for (int j = 0; j < N; j++)
+            {
+                std::string token;
+                if (!std::getline(ss, token, ','))
+                {
+                    return 1;
+                }
+                grid[(size_t)i * N + j] = std::stod(token);
+            }
+        }
+        file.close();
+    }
+
+    // The first N % size ranks take one extra row.
+    int rows = block_rows(N, size, rank);
+    int chunk = rows * N;
+    std::vector<int> sendcounts, displs;
+    block_counts(N, size, N, sendcounts, displs);
+    double *recv = new double[chunk];
+
+    {
+        trace::Span span("MPI_Scatterv", "comm");
+        MPI_Scatterv((rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, recv, chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    // The slab is padded with a ghost row above and below (filled by the
+    // halo exchange, or left at the boundary value on the outer ranks) and a
+    // ghost column on each side, so the tiled inner loop needs no boundary
+    // branches.
+    const int W = N + 2;
+    double *local = new double[(size_t)(rows + 2) * W];
+    double *temp = new double[(size_t)(rows + 2) * W];
+    for (size_t i = 0; i < (size_t)(rows + 2) * W; i++)
+    {
+        local[i] = stencil::Heat::BOUNDARY;
+        temp[i] = stencil::Heat::BOUNDARY;
+    }
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            local[(size_t)(i + 1) * W + j + 1] = recv[(size_t)i * N + j];
+        }
+    }
+
+    snapshot::Writer snap(N, N, block_start(N, size, rank), rows, rank);
+    converge::Check check(p.converge, p.converge_norm, p.converge_every, (double)N * N, omp_get_max_threads());
+    MPI_Pcontrol(1);
+    for (int t = 0; t < NUM_ITERS; t++)
+    {
+        MPI_Request req[4];
+        int req_count = 0;
+        if (rank != 0)
+            MPI_Irecv(&local[1], N, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+        if (rank != size - 1)
+            MPI_Irecv(&local[(size_t)(rows + 1) * W + 1], N, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+
+        if (rank != 0)
+            MPI_Isend(&local[W + 1], N, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+        if (rank != size - 1)
+            MPI_Isend(&local[(size_t)rows * W + 1], N, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+
+        // Rows 2..rows-1 only read rows owned by this rank, so the team
+        // computes them while the halo rows are in flight. The master thread
+        // pokes MPI between its tiles to keep the transfers progressing.
+        int halo_done = 0;
+        bool measure = check.due(t);
+        if (measure)
+            check.reset();
+#pragma omp parallel
+        {
+            converge::Change mine;
+            trace::Span interior("interior", "compute", t);
+#pragma omp for collapse(2) schedule(dynamic)
+            for (int ti = 2; ti <= rows - 1; ti += TILE_I)
+            {
+                for (int tj = 1; tj <= N; tj += TILE_J)
+                {
+                    int i_end = std::min(ti + TILE_I, rows);
+                    int j_end = std::min(tj + TILE_J, N + 1);
+
+                    for (int i = ti; i < i_end; i++)
+                    {
+                        stencil::row(heat, local, temp, W, i, tj, j_end);
+                        if (measure)
+                            mine.add(temp + (size_t)i * W + tj, local + (size_t)i * W + tj, j_end - tj);
+                    }
+
+                    if (omp_get_thread_num() == 0 && !halo_done)
+                        MPI_Testall(req_count, req, &halo_done, MPI_STATUSES_IGNORE);
+                }
+            }
+
+            interior.end();
+
+#pragma omp master
+            {
+                trace::Span span("MPI_Waitall", "wait", t);
+                if (!halo_done)
+                    MPI_Waitall(req_count, req, MPI_STATUSES_IGNORE);
+            }
+#pragma omp barrier
+
+            // First and last owned rows, now that the ghost rows are filled.
+            trace::Span edges("edge rows", "compute", t);
+            int last = rows > 1 ? 2 : 1;
+#pragma omp for collapse(2) schedule(static)
+            for (int b = 0; b < last; b++)
+            {
+                for (int tj = 1; tj <= N; tj += TILE_J)
+                {
+                    int i = b == 0 ? 1 : rows;
+                    int j_end = std::min(tj + TILE_J, N + 1);
+                    stencil::row(heat, local, temp, W, i, tj, j_end);
+                    if (measure)
+                        mine.add(temp + (size_t)i * W + tj, local + (size_t)i * W + tj, j_end - tj);
+                }
+            }
+            if (measure)
+                check.part(omp_get_thread_num()) = mine;
+        }
+
+        std::swap(local, temp);
+        snap.step(t + 1, [&](int i)
+                  { return local + (size_t)(i + 1) * W + 1; });
+        if (measure)
+        {
+            // Every rank gets the same value, so they all stop together.
+            double value = check.local(check.gather());
+            {
+                trace::Span span("MPI_Allreduce", "comm", t);
+                MPI_Allreduce(MPI_IN_PLACE, &value, 1, MPI_DOUBLE, check.sums() ? MPI_SUM : MPI_MAX, MPI_COMM_WORLD);
+            }
+            if (check.done(t, value))
+                break;
+        }
+    }
+    MPI_Pcontrol(2);
+    if (rank == 0)
+        check.report(NUM_ITERS);
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            recv[(size_t)i * N + j] = local[(size_t)(i + 1) * W + j + 1];
+        }
+    }
+    {
+        trace::Span span("MPI_Gatherv", "comm");
+        MPI_Gatherv(recv, chunk, MPI_DOUBLE, (rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    if (rank == 0)
+        write_output(grid, N, N);
+    delete[] grid;
+    delete[] recv;
+    delete[] local;
+    delete[] temp;
+    if (rank == 0)
+        std::cout << "Hybrid (" << omp_get_max_threads() << " threads/rank): " << MPI_Wtime() - t0;
+    MPI_Finalize();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return heat::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                        { return simulate(p, argc, argv); });
+}
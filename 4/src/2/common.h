@@ -7,23 +7,16 @@
 #include <vector>
 #include <cstring>
 #include <mpi.h>
+#include "shared/ingest_mpi.h"
+#include "shared/metrics_mpi.h"
+#include "shared/output.h"
+#include "shared/params.h"
+#include "shared/snapshot.h"
+#include "shared/stencil.h"
+#include "shared/partition.h"
+#include "shared/trace.h"
 
 constexpr int MPI_SIZE = 4;
 
-constexpr int N = 4000;
-constexpr double DX = 10.0;
-constexpr double DY = 10.0;
-constexpr int SIMULATION_TIME = 100;
-constexpr int TIME_STEP = 1;
-constexpr int SIMULATION_STEPS = SIMULATION_TIME / TIME_STEP;
-
-constexpr double DIFFUSION_COEFF = 1000;
-constexpr double DECAY_RATE = 3e-5;
-constexpr double DEPOSITION_RATE = 1e-4;
-constexpr double WIND_X = 3.3;
-constexpr double WIND_Y = 1.4;
-
 constexpr double INITIAL_CONTAMINATION = 1000.0;
-constexpr int INITIAL_X = N / 2;
-constexpr int INITIAL_Y = N / 2;
 #endif
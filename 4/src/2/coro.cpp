@@ -0,0 +1,159 @@
+#include "common.h"
+#include "shared/coro.h"
+
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
+{
+    const int N = p.n;
+    const int SIMULATION_STEPS = p.steps;
+    const stencil::Dispersion dispersion(p);
+
+    MPI_Init(&argc, &argv);
+    double t0 = MPI_Wtime();
+    int rank = -1, size = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    trace::set_rank(rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (N < size)
+    {
+        if (rank == 0)
+            std::cerr << "Need at least one grid row per rank" << std::endl;
+        MPI_Finalize();
+        return 1;
+    }
+    double *grid = new double[(size_t)N * N];
+    if (rank == 0)
+    {
+        std::ifstream file(argv[1]);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open file " << argv[1] << std::endl;
+            return 1;
+        }
+        std::string line;
+        for (int i = 0; i < N; i++)
+        {
+            if (!std::getline(file, line))
+            {
+                return 1;
+            }
+            std::istringstream ss(line);
+            for (int j = 0; j < N; j++)
+            {
+                std::string token;
+                if (!std::getline(ss, token, ','))
+                {
+                    return 1;
+                }
+                grid[(size_t)i * N + j] = std::stod(token);
+            }
+        }
+        file.close();
+    }
+
+    // The first N % size ranks take one extra row.
+    int rows = block_rows(N, size, rank);
+    int chunk = rows * N;
+    std::vector<int> sendcounts, displs;
+    block_counts(N, size, N, sendcounts, displs);
+    double *local = new double[chunk];
+
+    {
+        trace::Span span("MPI_Scatterv", "comm");
+        MPI_Scatterv((rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, local, chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    // The rank's rows as strips advanced by their own coroutines; see
+    // shared/coro.h.
+    std::vector<coro::Strip> strips = coro::split(N, N, size, rank, p.subdomains, stencil::Dispersion::BOUNDARY);
+    int base = block_start(N, size, rank);
+    for (auto &s : strips)
+    {
+        for (int i = 0; i < s.rows; i++)
+            std::copy(local + (size_t)(s.first - base + i) * N, local + (size_t)(s.first - base + i + 1) * N, s.row(i));
+    }
+    const int W = N + 2;
+    metrics::Set stats(N, p.dx * p.dy, rank == 0);
+    // Strips finish a step at different times, so each rank adds up its
+    // counts per step and rank 0 prints the totals after the loop.
+    std::vector<int> counts(SIMULATION_STEPS, 0), totals(SIMULATION_STEPS, 0);
+    metrics::Reducer stats_reduce(stats, rank, totals.data());
+    auto row = [=, &stats](const double *cur, double *next, int i, int first, metrics::Partial &part)
+    {
+        int uncontaminated = stencil::row(dispersion, cur, next, W, i, 1, N + 1);
+        stats.add(part, next + (size_t)i * W + 1, N, first + i - 1, 0);
+        return uncontaminated;
+    };
+
+    // Likewise each strip gathers its metrics for the step in acc and files
+    // them under (step, strip) when it finishes the step; they are merged
+    // in strip order after the loop.
+    const int K = (int)strips.size();
+    std::vector<metrics::Partial> acc(K), parts(stats.on ? (size_t)SIMULATION_STEPS * K : 0);
+
+    MPI_Pcontrol(1);
+    {
+        coro::Scheduler sched;
+        for (int k = 0; k < K; k++)
+        {
+            int first = strips[k].first;
+            auto strip_row = [&row, &acc, first, k](const double *cur, double *next, int i)
+            { return row(cur, next, i, first, acc[k]); };
+            sched.spawn(coro::advance(sched, strips[k], SIMULATION_STEPS, strip_row, [&, k](int t, long long count)
+                                      {
+                                          counts[t] += (int)count;
+                                          if (stats.on)
+                                          {
+                                              parts[(size_t)t * K + k] = acc[k];
+                                              acc[k] = metrics::Partial();
+                                          } }));
+        }
+        sched.run();
+    }
+    MPI_Pcontrol(2);
+
+    // The counts go to rank 0 with the metrics, in one reduction.
+    std::vector<metrics::Partial> steps(SIMULATION_STEPS);
+    for (int t = 0; t < SIMULATION_STEPS; t++)
+    {
+        for (int k = 0; k < (stats.on ? K : 0); k++)
+            steps[t].merge(parts[(size_t)t * K + k]);
+        steps[t].uncontaminated = counts[t];
+    }
+    stats_reduce.reduce_all(1, steps);
+    stats_reduce.finish();
+    if (rank == 0)
+    {
+        std::ostringstream out;
+        for (int t = 0; t < SIMULATION_STEPS; t++)
+        {
+            out << totals[t] << '\n';
+        }
+        std::cout << out.str();
+    }
+
+    for (auto &s : strips)
+    {
+        for (int i = 0; i < s.rows; i++)
+            std::copy(s.row(i), s.row(i) + N, local + (size_t)(s.first - base + i) * N);
+    }
+    {
+        trace::Span span("MPI_Gatherv", "comm");
+        MPI_Gatherv(local, chunk, MPI_DOUBLE, (rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    if (rank == 0)
+        write_output(grid, N, N);
+    delete[] grid;
+    delete[] local;
+    if (rank == 0)
+        std::cout << "Coroutines (" << strips.size() << " strips/rank): " << MPI_Wtime() - t0;
+    MPI_Finalize();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return dispersion::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                              { return simulate(p, argc, argv); });
+}
@@ -0,0 +1,230 @@
+#include "common.h"
+#include <omp.h>
+
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
+{
+    const int N = p.n;
+    const int SIMULATION_STEPS = p.steps;
+    const stencil::Dispersion dispersion(p);
+    const int TILE_I = p.tile_i;
+    const int TILE_J = p.tile_j;
+
+    // Only the master thread talks to MPI, the OpenMP team just computes.
+    int provided = 0;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    double t0 = MPI_Wtime();
+    int rank = -1, size = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    trace::set_rank(rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (N < size)
+    {
+        if (rank == 0)
+            std::cerr << "Need at least one grid row per rank" << std::endl;
+        MPI_Finalize();
+        return 1;
+    }
+    if (provided < MPI_THREAD_FUNNELED)
+    {
+        if (rank == 0)
+            std::cerr << "MPI library does not support MPI_THREAD_FUNNELED" << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    double *grid = new double[(size_t)N * N];
+    if (rank == 0)
+    {
+        std::ifstream file(argv[1]);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open file " << argv[1] << std::endl;
+            return 1;
+        }
+        std::string line;
+        for (int i = 0; i < N; i++)
+        {
+            if (!std::getline(file, line))
+            {
+                return 1;
+            }
+            std::istringstream ss(line);
+            for (int j = 0; j < N; j++)
+            {
+                std::string token;
+                if (!std::getline(ss, token, ','))
+                {
+                    return 1;
+                }
+                grid[(size_t)i * N + j] = std::stod(token);
+            }
+        }
+        file.close();
+    }
+
+    // The first N % size ranks take one extra row.
+    int rows = block_rows(N, size, rank);
+    int chunk = rows * N;
+    std::vector<int> sendcounts, displs;
+    block_counts(N, size, N, sendcounts, displs);
+    double *recv = new double[chunk];
+
+    {
+        trace::Span span("MPI_Scatterv", "comm");
+        MPI_Scatterv((rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, recv, chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    // The slab is padded with a ghost row above and below (filled by the
+    // halo exchange, or left at 0.0 on the outer ranks) and a ghost column
+    // on each side, so the tiled inner loop needs no boundary branches.
+    const int W = N + 2;
+    double *local = new double[(size_t)(rows + 2) * W]();
+    double *temp = new double[(size_t)(rows + 2) * W]();
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            local[(size_t)(i + 1) * W + j + 1] = recv[(size_t)i * N + j];
+        }
+    }
+
+    // Per-step counts go to rank 0 in the step's metrics::Partial, with one
+    // MPI_Ireduce completed one step later, so the step loop never blocks
+    // on rank 0. Rank 0 prints all of them in one batch after the loop.
+    int *totals = new int[SIMULATION_STEPS];
+
+    snapshot::Writer snap(N, N, block_start(N, size, rank), rows, rank);
+    metrics::Set stats(N, p.dx * p.dy, rank == 0);
+    metrics::Reducer stats_reduce(stats, rank, totals);
+    const int row0 = block_start(N, size, rank);
+    // One Partial per interior tile, then one per thread for the edge rows,
+    // merged in this order after each step whatever thread ran a tile.
+    const int tiles_j = (N + TILE_J - 1) / TILE_J;
+    const int tiles = rows > 2 ? (rows - 2 + TILE_I - 1) / TILE_I * tiles_j : 0;
+    std::vector<metrics::Partial> parts(tiles + omp_get_max_threads());
+    MPI_Pcontrol(1);
+    for (int t = 0; t < SIMULATION_STEPS; t++)
+    {
+        MPI_Request req[4];
+        int req_count = 0;
+        int uncontaminated = 0;
+        if (rank != 0)
+            MPI_Irecv(&local[1], N, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+        if (rank != size - 1)
+            MPI_Irecv(&local[(size_t)(rows + 1) * W + 1], N, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+
+        if (rank != 0)
+            MPI_Isend(&local[W + 1], N, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+        if (rank != size - 1)
+            MPI_Isend(&local[(size_t)rows * W + 1], N, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &req[req_count++]);
+
+        // Rows 2..rows-1 only read rows owned by this rank, so the team
+        // computes them while the halo rows are in flight. The master thread
+        // pokes MPI between its tiles to keep the transfers progressing.
+        int halo_done = 0;
+#pragma omp parallel reduction(+ : uncontaminated)
+        {
+            trace::Span interior("interior", "compute", t);
+#pragma omp for collapse(2) schedule(dynamic)
+            for (int ti = 2; ti <= rows - 1; ti += TILE_I)
+            {
+                for (int tj = 1; tj <= N; tj += TILE_J)
+                {
+                    int i_end = std::min(ti + TILE_I, rows);
+                    int j_end = std::min(tj + TILE_J, N + 1);
+                    metrics::Partial part;
+
+                    for (int i = ti; i < i_end; i++)
+                    {
+                        uncontaminated += stencil::row(dispersion, local, temp, W, i, tj, j_end);
+                        stats.add(part, temp + (size_t)i * W + tj, j_end - tj, row0 + i - 1, tj - 1);
+                    }
+                    parts[(ti - 2) / TILE_I * tiles_j + (tj - 1) / TILE_J] = part;
+
+                    if (omp_get_thread_num() == 0 && !halo_done)
+                        MPI_Testall(req_count, req, &halo_done, MPI_STATUSES_IGNORE);
+                }
+            }
+
+            interior.end();
+
+#pragma omp master
+            {
+                trace::Span span("MPI_Waitall", "wait", t);
+                if (!halo_done)
+                    MPI_Waitall(req_count, req, MPI_STATUSES_IGNORE);
+            }
+#pragma omp barrier
+
+            // First and last owned rows, now that the ghost rows are filled.
+            trace::Span edges("edge rows", "compute", t);
+            int last = rows > 1 ? 2 : 1;
+            metrics::Partial part;
+#pragma omp for collapse(2) schedule(static)
+            for (int b = 0; b < last; b++)
+            {
+                for (int tj = 1; tj <= N; tj += TILE_J)
+                {
+                    int i = b == 0 ? 1 : rows;
+                    int j_end = std::min(tj + TILE_J, N + 1);
+                    uncontaminated += stencil::row(dispersion, local, temp, W, i, tj, j_end);
+                    stats.add(part, temp + (size_t)i * W + tj, j_end - tj, row0 + i - 1, tj - 1);
+                }
+            }
+            parts[tiles + omp_get_thread_num()] = part;
+        }
+
+        std::swap(local, temp);
+        snap.step(t + 1, [&](int i)
+                  { return local + (size_t)(i + 1) * W + 1; });
+        metrics::Partial part;
+        if (stats.on)
+        {
+            for (const auto &tile : parts)
+                part.merge(tile);
+        }
+        part.uncontaminated = uncontaminated;
+        stats_reduce.post(t + 1, part);
+    }
+    MPI_Pcontrol(2);
+
+    stats_reduce.finish();
+    if (rank == 0)
+    {
+        std::ostringstream out;
+        for (int t = 0; t < SIMULATION_STEPS; t++)
+        {
+            out << totals[t] << '\n';
+        }
+        std::cout << out.str();
+    }
+    delete[] totals;
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            recv[(size_t)i * N + j] = local[(size_t)(i + 1) * W + j + 1];
+        }
+    }
+    {
+        trace::Span span("MPI_Gatherv", "comm");
+        MPI_Gatherv(recv, chunk, MPI_DOUBLE, (rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    if (rank == 0)
+        write_output(grid, N, N);
+    delete[] grid;
+    delete[] recv;
+    delete[] local;
+    delete[] temp;
+    if (rank == 0)
+        std::cout << "Hybrid (" << omp_get_max_threads() << " threads/rank): " << MPI_Wtime() - t0;
+    MPI_Finalize();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return dispersion::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                              { return simulate(p, argc, argv); });
+}
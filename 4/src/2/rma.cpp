@@ -0,0 +1,279 @@
+#include "common.h"
+#include <cstring>
+
+// One-sided halo exchange.
+//   ./rma input.csv pscw    neighbours MPI_Put their boundary rows straight
+//                           into our exposed ghost rows (post/start/complete/wait)
+//   ./rma input.csv shared  ranks on the same node allocate their slabs with
+//                           MPI_Win_allocate_shared and read the neighbour's
+//                           boundary row in place; only off-node neighbours
+//                           fall back to the PSCW puts
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
+{
+    const int N = p.n;
+    const int SIMULATION_STEPS = p.steps;
+    const stencil::Dispersion dispersion(p);
+
+    MPI_Init(&argc, &argv);
+    double t0 = MPI_Wtime();
+    int rank = -1, size = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    trace::set_rank(rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (N < size)
+    {
+        if (rank == 0)
+            std::cerr << "Need at least one grid row per rank" << std::endl;
+        MPI_Finalize();
+        return 1;
+    }
+    bool shared = argc > 2 && std::strcmp(argv[2], "shared") == 0;
+    double *grid = new double[(size_t)N * N];
+    if (rank == 0)
+    {
+        std::ifstream file(argv[1]);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open file " << argv[1] << std::endl;
+            return 1;
+        }
+        std::string line;
+        for (int i = 0; i < N; i++)
+        {
+            if (!std::getline(file, line))
+            {
+                return 1;
+            }
+            std::istringstream ss(line);
+            for (int j = 0; j < N; j++)
+            {
+                std::string token;
+                if (!std::getline(ss, token, ','))
+                {
+                    return 1;
+                }
+                grid[(size_t)i * N + j] = std::stod(token);
+            }
+        }
+        file.close();
+    }
+
+    // The first N % size ranks take one extra row.
+    int rows = block_rows(N, size, rank);
+    int chunk = rows * N;
+    std::vector<int> sendcounts, displs;
+    block_counts(N, size, N, sendcounts, displs);
+    double *recv = new double[chunk];
+
+    {
+        trace::Span span("MPI_Scatterv", "comm");
+        MPI_Scatterv((rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, recv, chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    // Each rank exposes only its two ghost rows ([north][south], padded with
+    // a ghost column on each side) in a window on MPI_COMM_WORLD; neighbours
+    // put their boundary rows there. The slab itself holds both time levels,
+    // [buffer 0][buffer 1], and in shared mode it is allocated in a node-wide
+    // shared window so on-node neighbours can read it in place.
+    const int W = N + 2;
+    // Sized for the largest slab so every rank's time levels sit at the
+    // same offsets, which shared mode relies on when reading a neighbour's.
+    const size_t slab = (size_t)block_rows(N, size, 0) * W;
+    double *ghost = nullptr;
+    MPI_Win win, shm_win = MPI_WIN_NULL;
+    MPI_Win_allocate((MPI_Aint)2 * W * sizeof(double), sizeof(double), MPI_INFO_NULL, MPI_COMM_WORLD, &ghost, &win);
+
+    double *base = nullptr;
+    MPI_Comm node_comm = MPI_COMM_NULL;
+    int node_size = 1;
+    bool on_node[2] = {false, false};
+    double *nbr_base[2] = {nullptr, nullptr};
+    int nbr[2] = {rank - 1, rank + 1};
+
+    if (shared)
+    {
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+        MPI_Comm_size(node_comm, &node_size);
+        MPI_Win_allocate_shared((MPI_Aint)2 * slab * sizeof(double), sizeof(double), MPI_INFO_NULL, node_comm, &base, &shm_win);
+
+        MPI_Group world_group, node_group;
+        MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+        MPI_Comm_group(node_comm, &node_group);
+        for (int d = 0; d < 2; d++)
+        {
+            if (nbr[d] < 0 || nbr[d] >= size)
+                continue;
+            int node_rank = MPI_UNDEFINED;
+            MPI_Group_translate_ranks(world_group, 1, &nbr[d], node_group, &node_rank);
+            if (node_rank != MPI_UNDEFINED)
+            {
+                MPI_Aint seg_size;
+                int disp_unit;
+                MPI_Win_shared_query(shm_win, node_rank, &seg_size, &disp_unit, &nbr_base[d]);
+                on_node[d] = true;
+            }
+        }
+        MPI_Group_free(&world_group);
+        MPI_Group_free(&node_group);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, shm_win);
+    }
+    else
+    {
+        base = new double[2 * slab];
+    }
+
+    for (int i = 0; i < 2 * W; i++)
+    {
+        ghost[i] = stencil::Dispersion::BOUNDARY;
+    }
+    for (size_t i = 0; i < 2 * slab; i++)
+    {
+        base[i] = stencil::Dispersion::BOUNDARY;
+    }
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            base[(size_t)i * W + j + 1] = recv[(size_t)i * N + j];
+        }
+    }
+
+    // Neighbours reached through puts form both the exposure and the access
+    // group of every epoch.
+    int put_ranks[2];
+    int put_count = 0;
+    for (int d = 0; d < 2; d++)
+    {
+        if (nbr[d] >= 0 && nbr[d] < size && !on_node[d])
+            put_ranks[put_count++] = nbr[d];
+    }
+    MPI_Group world_group, put_group;
+    MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+    MPI_Group_incl(world_group, put_count, put_ranks, &put_group);
+    MPI_Group_free(&world_group);
+
+    // Make sure every rank has initialized its slab before anyone reads it.
+    if (shared)
+        MPI_Win_sync(shm_win);
+    {
+        trace::Span span("MPI_Barrier", "wait");
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    // Per-step counts go to rank 0 in the step's metrics::Partial, with one
+    // MPI_Ireduce completed one step later, so the step loop never blocks
+    // on rank 0. Rank 0 prints all of them in one batch after the loop.
+    int *totals = new int[SIMULATION_STEPS];
+
+    snapshot::Writer snap(N, N, block_start(N, size, rank), rows, rank);
+    metrics::Set stats(N, p.dx * p.dy, rank == 0);
+    metrics::Reducer stats_reduce(stats, rank, totals);
+    const int row0 = block_start(N, size, rank);
+    MPI_Pcontrol(1);
+    for (int t = 0; t < SIMULATION_STEPS; t++)
+    {
+        size_t cur_off = (t % 2) * slab;
+        double *local = base + cur_off;
+        double *temp = base + (1 - t % 2) * slab;
+        int uncontaminated = 0;
+        metrics::Partial part;
+
+        // The post only happens once we are done reading the ghost rows of
+        // the previous step, so a single pair of ghost rows is enough.
+        if (put_count > 0)
+        {
+            trace::Span span("PSCW epoch", "comm", t);
+            MPI_Win_post(put_group, 0, win);
+            MPI_Win_start(put_group, 0, win);
+            if (nbr[0] >= 0 && !on_node[0])
+                MPI_Put(&local[1], N, MPI_DOUBLE, nbr[0], W + 1, N, MPI_DOUBLE, win);
+            if (nbr[1] < size && !on_node[1])
+                MPI_Put(&local[(size_t)(rows - 1) * W + 1], N, MPI_DOUBLE, nbr[1], 1, N, MPI_DOUBLE, win);
+            MPI_Win_complete(win);
+            MPI_Win_wait(win);
+        }
+        if (shared && node_size > 1)
+        {
+            // Everyone on the node has finished the previous step, so the
+            // neighbours' current rows are final and nobody is still reading
+            // the buffer we are about to overwrite.
+            trace::Span span("node barrier", "wait", t);
+            MPI_Win_sync(shm_win);
+            MPI_Barrier(node_comm);
+            MPI_Win_sync(shm_win);
+        }
+
+        const double *north = on_node[0] ? nbr_base[0] + cur_off + (size_t)(block_rows(N, size, rank - 1) - 1) * W : ghost;
+        const double *south = on_node[1] ? nbr_base[1] + cur_off : ghost + W;
+
+        trace::Span compute("compute", "compute", t);
+        for (int i = 0; i < rows; i++)
+        {
+            const double *up = i == 0 ? north : local + (size_t)(i - 1) * W;
+            const double *mid = local + (size_t)i * W;
+            const double *down = i == rows - 1 ? south : local + (size_t)(i + 1) * W;
+            uncontaminated += stencil::row(dispersion, up, mid, down, temp + (size_t)i * W, 1, N + 1);
+            stats.add(part, temp + (size_t)i * W + 1, N, row0 + i, 0);
+        }
+        compute.end();
+        snap.step(t + 1, [&](int i)
+                  { return temp + (size_t)i * W + 1; });
+
+        part.uncontaminated = uncontaminated;
+        stats_reduce.post(t + 1, part);
+    }
+    MPI_Pcontrol(2);
+
+    stats_reduce.finish();
+    if (rank == 0)
+    {
+        std::ostringstream out;
+        for (int t = 0; t < SIMULATION_STEPS; t++)
+        {
+            out << totals[t] << '\n';
+        }
+        std::cout << out.str();
+    }
+    delete[] totals;
+
+    double *local = base + (SIMULATION_STEPS % 2) * slab;
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            recv[(size_t)i * N + j] = local[(size_t)i * W + j + 1];
+        }
+    }
+    {
+        trace::Span span("MPI_Gatherv", "comm");
+        MPI_Gatherv(recv, chunk, MPI_DOUBLE, (rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    MPI_Group_free(&put_group);
+    MPI_Win_free(&win);
+    if (shared)
+    {
+        MPI_Win_unlock_all(shm_win);
+        MPI_Win_free(&shm_win);
+        MPI_Comm_free(&node_comm);
+    }
+    else
+    {
+        delete[] base;
+    }
+    if (rank == 0)
+        write_output(grid, N, N);
+    delete[] grid;
+    delete[] recv;
+    if (rank == 0)
+        std::cout << "RMA (" << (shared ? "shared" : "pscw") << "): " << MPI_Wtime() - t0;
+    MPI_Finalize();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return dispersion::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                              { return simulate(p, argc, argv); });
+}
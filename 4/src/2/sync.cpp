@@ -1,14 +1,30 @@
 #include "common.h"
 
-int main(int argc, char *argv[])
+template <typename Params>
+int simulate(const Params &p, int argc, char *argv[])
 {
+    const int N = p.n;
+    const int SIMULATION_STEPS = p.steps;
+    const stencil::Dispersion dispersion(p);
+
     MPI_Init(&argc, &argv);
     double t0 = MPI_Wtime();
     int rank = -1, size = 0;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    trace::set_rank(rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
-    MPI_Barrier(MPI_COMM_WORLD);
-    double *grid = new double[N * N];
+    if (N < size)
+    {
+        if (rank == 0)
+            std::cerr << "Need at least one grid row per rank" << std::endl;
+        MPI_Finalize();
+        return 1;
+    }
+    {
+        trace::Span span("MPI_Barrier", "wait");
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+    double *grid = new double[(size_t)N * N];
     if (rank == 0)
     {
         std::ifstream file(argv[1]);
@@ -32,99 +48,116 @@ int main(int argc, char *argv[])
                 {
                     return 1;
                 }
-                grid[i * N + j] = std::stod(token);
+                grid[(size_t)i * N + j] = std::stod(token);
             }
         }
         file.close();
     }
 
-    int chunk = (N / size) * N;
-    double *local = new double[chunk];
-    double *temp = new double[chunk];
+    // The first N % size ranks take one extra row.
+    int rows = block_rows(N, size, rank);
+    int chunk = rows * N;
+    std::vector<int> sendcounts, displs;
+    block_counts(N, size, N, sendcounts, displs);
+    double *recv = new double[chunk];
+
+    {
+        trace::Span span("MPI_Scatterv", "comm");
+        MPI_Scatterv((rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, recv, chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+
+    // The slab is padded with a halo row above and below (received from the
+    // neighbours, or left at the boundary value on the outer ranks) and a
+    // boundary column on each side, so the stencil needs no branches.
+    const int W = N + 2;
+    double *local = new double[(size_t)(rows + 2) * W];
+    double *temp = new double[(size_t)(rows + 2) * W];
+    std::fill(local, local + (size_t)(rows + 2) * W, stencil::Dispersion::BOUNDARY);
+    std::fill(temp, temp + (size_t)(rows + 2) * W, stencil::Dispersion::BOUNDARY);
+    for (int i = 0; i < rows; i++)
+        std::copy(recv + (size_t)i * N, recv + (size_t)(i + 1) * N, local + (size_t)(i + 1) * W + 1);
 
-    MPI_Scatter((rank == 0 ? grid : nullptr), chunk, MPI_DOUBLE, local, chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    // Per-step counts go to rank 0 in the step's metrics::Partial, with one
+    // MPI_Ireduce completed one step later, so the step loop never blocks
+    // on rank 0. Rank 0 prints all of them in one batch after the loop.
+    int *totals = new int[SIMULATION_STEPS];
 
+    snapshot::Writer snap(N, N, block_start(N, size, rank), rows, rank);
+    metrics::Set stats(N, p.dx * p.dy, rank == 0);
+    metrics::Reducer stats_reduce(stats, rank, totals);
+    const int row0 = block_start(N, size, rank);
+    MPI_Pcontrol(1);
     for (int t = 0; t < SIMULATION_STEPS; t++)
     {
-        double *prev = new double[N];
-        double *next = new double[N];
         int uncontaminated = 0;
-        int total_uncontaminated = 0;
-        if (rank != 0 && rank != size - 1)
+        metrics::Partial part;
+        trace::Span halo("MPI_Sendrecv", "comm", t);
+        if (rank != 0)
         {
-
-            MPI_Sendrecv(local, N, MPI_DOUBLE, rank - 1, 0,
-                         prev, N, MPI_DOUBLE, rank - 1, 0,
-                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-            MPI_Sendrecv(&local[(N / size - 1) * N], N, MPI_DOUBLE, rank + 1, 0,
-                         next, N, MPI_DOUBLE, rank + 1, 0,
+            MPI_Sendrecv(&local[W + 1], N, MPI_DOUBLE, rank - 1, 0,
+                         &local[1], N, MPI_DOUBLE, rank - 1, 0,
                          MPI_COMM_WORLD, MPI_STATUS_IGNORE);
         }
-        else if (rank == 0)
+        if (rank != size - 1)
         {
-
-            MPI_Sendrecv(&local[(N / size - 1) * N], N, MPI_DOUBLE, rank + 1, 0,
-                         next, N, MPI_DOUBLE, rank + 1, 0,
+            MPI_Sendrecv(&local[(size_t)rows * W + 1], N, MPI_DOUBLE, rank + 1, 0,
+                         &local[(size_t)(rows + 1) * W + 1], N, MPI_DOUBLE, rank + 1, 0,
                          MPI_COMM_WORLD, MPI_STATUS_IGNORE);
         }
-        else if (rank == size - 1)
+        halo.end();
+        trace::Span compute("compute", "compute", t);
+        for (int i = 1; i <= rows; i++)
         {
-
-            MPI_Sendrecv(local, N, MPI_DOUBLE, rank - 1, 0,
-                         prev, N, MPI_DOUBLE, rank - 1, 0,
-                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            uncontaminated += stencil::row(dispersion, local, temp, W, i, 1, N + 1);
+            stats.add(part, temp + (size_t)i * W + 1, N, row0 + i - 1, 0);
         }
-        for (int i = 0; i < N / size; i++)
-        {
-            for (int j = 0; j < N; j++)
-            {
-                double n, s;
-                if (i > 0)
-                {
-                    n = local[(i - 1) * N + j];
-                }
-                else
-                {
-                    n = (rank != 0) ? prev[j] : 0.0;
-                }
-
-                if (i < N / size - 1)
-                {
-                    s = local[(i + 1) * N + j];
-                }
-                else
-                {
-                    s = (rank != size - 1) ? next[j] : 0.0;
-                }
+        compute.end();
 
-                double w = j > 0 ? local[i * N + (j - 1)] : 0;
-                double e = j < N - 1 ? local[i * N + (j + 1)] : 0;
-                double cur = local[i * N + j];
+        std::swap(local, temp);
+        snap.step(t + 1, [&](int i)
+                  { return local + (size_t)(i + 1) * W + 1; });
+        part.uncontaminated = uncontaminated;
+        stats_reduce.post(t + 1, part);
+        {
+            trace::Span span("MPI_Barrier", "wait", t);
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+    }
+    MPI_Pcontrol(2);
 
-                double advection = WIND_X * (cur - n) / DX + WIND_Y * (cur - w) / DY;
-                double diffusion = DIFFUSION_COEFF * (s - 2 * cur + n) / (DX * DX) + DIFFUSION_COEFF * (e - 2 * cur + w) / (DY * DY);
-                double decay = DECAY_RATE * cur + DEPOSITION_RATE * cur;
-                cur = cur + TIME_STEP * (-advection + diffusion - decay);
-                temp[i * N + j] = std::max(0.0, cur);
-                if (temp[i * N + j] == 0)
-                    uncontaminated++;
-            }
+    stats_reduce.finish();
+    if (rank == 0)
+    {
+        std::ostringstream out;
+        for (int t = 0; t < SIMULATION_STEPS; t++)
+        {
+            out << totals[t] << '\n';
         }
+        std::cout << out.str();
+    }
+    delete[] totals;
 
-        delete[] prev;
-        delete[] next;
-        std::swap(local, temp);
-        MPI_Reduce(&uncontaminated, &total_uncontaminated, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
-        if (rank == 0)
-            std::cout << total_uncontaminated << std::endl;
-        MPI_Barrier(MPI_COMM_WORLD);
+    for (int i = 0; i < rows; i++)
+        std::copy(local + (size_t)(i + 1) * W + 1, local + (size_t)(i + 1) * W + 1 + N, recv + (size_t)i * N);
+    {
+        trace::Span span("MPI_Gatherv", "comm");
+        MPI_Gatherv(recv, chunk, MPI_DOUBLE, (rank == 0 ? grid : nullptr), sendcounts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
     }
-    MPI_Gather(local, chunk, MPI_DOUBLE, (rank == 0 ? grid : nullptr), chunk, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
+    if (rank == 0)
+        write_output(grid, N, N);
     delete[] grid;
+    delete[] recv;
+    delete[] local;
+    delete[] temp;
     if (rank == 0)
         std::cout << "Parallel: " << MPI_Wtime() - t0;
     MPI_Finalize();
     return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return dispersion::launch(argc, argv, [](const auto &p, int argc, char *argv[])
+                              { return simulate(p, argc, argv); });
 }
\ No newline at end of file
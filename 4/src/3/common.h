@@ -3,11 +3,8 @@
 #include <mpi.h>
 #include <vector>
 #include <cmath>
-
-constexpr int TIME = 100;
-constexpr int N = 4000;
-constexpr long W = 5000000000;
-
-const int CENTER_X = N / 2;
-const int CENTER_Y = N / 2;
-constexpr int CELL_SIZE = 10;
\ No newline at end of file
+#include "shared/output.h"
+#include "shared/params.h"
+#include "shared/partition.h"
+#include "shared/snapshot.h"
+#include "shared/trace.h"
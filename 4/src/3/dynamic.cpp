@@ -0,0 +1,190 @@
+#include "common.h"
+#include <algorithm>
+#include <deque>
+
+#define TAG_ASSIGN 1
+#define TAG_RESULT 2
+
+int sq(int x)
+{
+    return x * x;
+}
+
+// Computes rows [first, first + rows) for every time step into out, which
+// holds those rows contiguously.
+void compute_rows(const shock::Params &p, double *out, int first, int rows, const double *c)
+{
+    const int N = p.n;
+    const int TIME = p.time;
+    const double W = p.yield;
+    const double CELL_SIZE = p.cell_size;
+    const int CENTER_X = N / 2;
+    const int CENTER_Y = N / 2;
+
+    trace::Span span("chunk", "compute");
+    for (size_t i = 0; i < (size_t)rows * N; i++)
+    {
+        out[i] = 0.0;
+    }
+    for (int t = 0; t < TIME; t++)
+    {
+        for (int i = 0; i < rows; i++)
+        {
+            int global_i = first + i;
+            for (int j = 0; j < N; j++)
+            {
+                double R = sqrt(sq(global_i - CENTER_X) + sq(j - CENTER_Y)) * CELL_SIZE;
+
+                if (t >= R / 343.0)
+                {
+                    double Z = R * pow(W, -1.0 / 3.0);
+                    double U = -0.21436 + 1.35034 * log10(Z);
+                    double log10P = 0.0;
+                    for (int k = 0; k < 9; k++)
+                    {
+                        log10P += c[k] * pow(U, k);
+                    }
+                    out[(size_t)i * N + j] = pow(10.0, log10P);
+                }
+            }
+        }
+    }
+}
+
+// Master/worker row distribution. Rows near CENTER_X become active long
+// before the edge rows, so instead of a static block per rank the grid is cut
+// into chunks of --chunk rows (default 16, at most n) that rank 0 hands out
+// on demand. Every worker always holds one chunk in reserve (its next
+// assignment is received with MPI_Irecv while it computes), and rank 0
+// computes chunks itself whenever no result is waiting to be collected.
+//   mpirun -np 3 ./dynamic --chunk 16
+int simulate(const shock::Params &p, int argc, char *argv[])
+{
+    const int N = p.n;
+
+    MPI_Init(&argc, &argv);
+
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    trace::set_rank(rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    const double c[9] = {2.611369, -1.690128, 0.00805, 0.336743, -0.005162, -0.080923, -0.004785, 0.007930, 0.000768};
+
+    const int chunk_rows = std::min(p.chunk, N);
+    int num_chunks = (N + chunk_rows - 1) / chunk_rows;
+
+    MPI_Pcontrol(1);
+    double start = MPI_Wtime();
+
+    if (rank == 0)
+    {
+        double *grid = new double[(size_t)N * N];
+        std::vector<std::deque<int>> assigned(size);
+        int next_chunk = 0;
+        int outstanding = 0;
+
+        // Sends the next chunk (or -1 once all are handed out) to worker p.
+        auto assign = [&](int p)
+        {
+            int first = next_chunk < num_chunks ? next_chunk++ * chunk_rows : -1;
+            MPI_Send(&first, 1, MPI_INT, p, TAG_ASSIGN, MPI_COMM_WORLD);
+            if (first >= 0)
+            {
+                assigned[p].push_back(first);
+                outstanding++;
+            }
+        };
+
+        for (int p = 1; p < size; p++)
+        {
+            assign(p);
+            assign(p);
+        }
+
+        while (outstanding > 0 || next_chunk < num_chunks)
+        {
+            int flag = 0;
+            MPI_Status status;
+            MPI_Iprobe(MPI_ANY_SOURCE, TAG_RESULT, MPI_COMM_WORLD, &flag, &status);
+            if (!flag && next_chunk < num_chunks)
+            {
+                int first = next_chunk++ * chunk_rows;
+                compute_rows(p, &grid[(size_t)first * N], first, std::min(chunk_rows, N - first), c);
+                continue;
+            }
+            if (!flag)
+            {
+                trace::Span span("MPI_Probe", "wait");
+                MPI_Probe(MPI_ANY_SOURCE, TAG_RESULT, MPI_COMM_WORLD, &status);
+            }
+
+            // Results from one worker arrive in the order its chunks were
+            // assigned, so they go straight into their final rows.
+            int p = status.MPI_SOURCE;
+            int first = assigned[p].front();
+            assigned[p].pop_front();
+            {
+                trace::Span span("MPI_Recv", "comm");
+                MPI_Recv(&grid[(size_t)first * N], std::min(chunk_rows, N - first) * N, MPI_DOUBLE, p, TAG_RESULT, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            }
+            outstanding--;
+            assign(p);
+        }
+        MPI_Pcontrol(2);
+
+        std::cout << "Dynamic MPI Time: "
+                  << MPI_Wtime() - start
+                  << " seconds (chunk " << chunk_rows << " rows)" << std::endl;
+
+        write_output(grid, N, N);
+        delete[] grid;
+    }
+    else
+    {
+        // Two result buffers so a chunk can be computed while the previous
+        // one is still being sent.
+        std::vector<double> buf[2] = {std::vector<double>((size_t)chunk_rows * N), std::vector<double>((size_t)chunk_rows * N)};
+        MPI_Request send_req[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+        MPI_Request assign_req;
+        int cur, next;
+        int b = 0;
+
+        MPI_Recv(&cur, 1, MPI_INT, 0, TAG_ASSIGN, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        MPI_Irecv(&next, 1, MPI_INT, 0, TAG_ASSIGN, MPI_COMM_WORLD, &assign_req);
+        while (cur >= 0)
+        {
+            {
+                trace::Span span("MPI_Wait send", "wait");
+                MPI_Wait(&send_req[b], MPI_STATUS_IGNORE);
+            }
+            int rows = std::min(chunk_rows, N - cur);
+            compute_rows(p, buf[b].data(), cur, rows, c);
+            MPI_Isend(buf[b].data(), rows * N, MPI_DOUBLE, 0, TAG_RESULT, MPI_COMM_WORLD, &send_req[b]);
+            b ^= 1;
+
+            {
+                trace::Span span("MPI_Wait assign", "wait");
+                MPI_Wait(&assign_req, MPI_STATUS_IGNORE);
+            }
+            cur = next;
+            MPI_Irecv(&next, 1, MPI_INT, 0, TAG_ASSIGN, MPI_COMM_WORLD, &assign_req);
+        }
+
+        // Rank 0 answers every result, so one more (stop) message is due.
+        {
+            trace::Span span("MPI_Wait assign", "wait");
+            MPI_Wait(&assign_req, MPI_STATUS_IGNORE);
+        }
+        MPI_Waitall(2, send_req, MPI_STATUSES_IGNORE);
+        MPI_Pcontrol(2);
+    }
+
+    MPI_Finalize();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return shock::launch(argc, argv, simulate);
+}
@@ -5,47 +5,53 @@ int sq(int x)
     return x * x;
 }
 
-int main(int argc, char *argv[])
+int simulate(const shock::Params &p, int argc, char *argv[])
 {
+    const int N = p.n;
+    const int TIME = p.time;
+    const double W = p.yield;
+    const double CELL_SIZE = p.cell_size;
+    const int CENTER_X = N / 2;
+    const int CENTER_Y = N / 2;
+
     MPI_Init(&argc, &argv);
 
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    trace::set_rank(rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
-    MPI_Barrier(MPI_COMM_WORLD);
+    {
+        trace::Span span("MPI_Barrier", "wait");
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
     const double c[9] = {2.611369, -1.690128, 0.00805, 0.336743, -0.005162, -0.080923, -0.004785, 0.007930, 0.000768};
 
-    int rows_per_proc = N / size;
-    int remainder = N % size;
-    int start_row = rank * rows_per_proc + std::min(rank, remainder);
-    int end_row = start_row + rows_per_proc + (rank < remainder ? 1 : 0);
-    int local_rows = end_row - start_row;
+    // The first N % size ranks take one extra row.
+    int start_row = block_start(N, size, rank);
+    int local_rows = block_rows(N, size, rank);
 
-    double **local_grid = new double *[local_rows];
-    for (int i = 0; i < local_rows; i++)
+    double *local_grid = new double[(size_t)local_rows * N];
+    for (size_t i = 0; i < (size_t)local_rows * N; i++)
     {
-        local_grid[i] = new double[N];
-        for (int j = 0; j < N; j++)
-        {
-            local_grid[i][j] = 0.0;
-        }
+        local_grid[i] = 0.0;
     }
 
-    double **grid = nullptr;
+    // The full grid lives contiguously on rank 0 so every rank's slab can be
+    // received straight into its final rows with one MPI_Gatherv.
+    double *grid = nullptr;
+    std::vector<int> counts, displs;
+    block_counts(N, size, N, counts, displs);
     if (rank == 0)
-    {
-        grid = new double *[N];
-        for (int i = 0; i < N; i++)
-        {
-            grid[i] = new double[N];
-        }
-    }
+        grid = new double[(size_t)N * N];
 
     double start = MPI_Wtime();
 
+    snapshot::Writer snap(N, N, start_row, local_rows, rank);
+    MPI_Pcontrol(1);
     for (int t = 0; t < TIME; t++)
     {
 
+        trace::Span compute("compute", "compute", t);
         for (int i = 0; i < local_rows; i++)
         {
             int global_i = start_row + i;
@@ -62,45 +68,24 @@ int main(int argc, char *argv[])
                     {
                         log10P += c[k] * pow(U, k);
                     }
-                    local_grid[i][j] = pow(10.0, log10P);
+                    local_grid[(size_t)i * N + j] = pow(10.0, log10P);
                 }
             }
         }
+        compute.end();
+        snap.step(t + 1, [&](int i)
+                  { return local_grid + (size_t)i * N; });
 
-        MPI_Barrier(MPI_COMM_WORLD);
-    }
-
-    if (rank == 0)
-    {
-
-        for (int i = 0; i < local_rows; i++)
-        {
-            for (int j = 0; j < N; j++)
-            {
-                grid[start_row + i][j] = local_grid[i][j];
-            }
-        }
-
-        for (int p = 1; p < size; p++)
         {
-            int p_rows_per_proc = N / size;
-            int p_remainder = N % size;
-            int p_start_row = p * p_rows_per_proc + std::min(p, p_remainder);
-            int p_local_rows = p_rows_per_proc + (p < p_remainder ? 1 : 0);
-
-            for (int i = 0; i < p_local_rows; i++)
-            {
-                MPI_Recv(grid[p_start_row + i], N, MPI_DOUBLE, p, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            }
+            trace::Span span("MPI_Barrier", "wait", t);
+            MPI_Barrier(MPI_COMM_WORLD);
         }
     }
-    else
-    {
+    MPI_Pcontrol(2);
 
-        for (int i = 0; i < local_rows; i++)
-        {
-            MPI_Send(local_grid[i], N, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-        }
+    {
+        trace::Span span("MPI_Gatherv", "comm");
+        MPI_Gatherv(local_grid, local_rows * N, MPI_DOUBLE, grid, counts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
     }
 
     if (rank == 0)
@@ -110,21 +95,16 @@ int main(int argc, char *argv[])
                   << " seconds" << std::endl;
     }
 
-    for (int i = 0; i < local_rows; i++)
-    {
-        delete[] local_grid[i];
-    }
     delete[] local_grid;
-
-    if (rank == 0 && grid != nullptr)
-    {
-        for (int i = 0; i < N; i++)
-        {
-            delete[] grid[i];
-        }
-        delete[] grid;
-    }
+    if (rank == 0)
+        write_output(grid, N, N);
+    delete[] grid;
 
     MPI_Finalize();
     return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    return shock::launch(argc, argv, simulate);
 }
\ No newline at end of file
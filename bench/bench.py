@@ -0,0 +1,292 @@
+#!/usr/bin/env python3
+"""Benchmark driver for the heat, dispersion and shock wave simulations.
+
+It builds all variants once, then for every grid size generates a synthetic
+input, runs each variant with --n over the thread/rank matrix, checks the
+final field against the sequential reference and reports median/min/stddev,
+speedup, efficiency, cells/s and effective GB/s as a table, JSON and CSV.
+
+    python3 bench/bench.py --sizes 512,1024 --threads 1,2,4 --ranks 1,2,4 \\
+        --reps 5 --json bench.json --csv bench.csv
+
+Only the standard library is needed.
+"""
+
+import argparse
+import array
+import csv
+import json
+import math
+import os
+import platform
+import re
+import shlex
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Time steps per run, the defaults in shared/params.h.
+STEPS = {"heat": 100, "dispersion": 100, "shock": 100}
+
+# Bytes moved per cell update assuming perfect reuse of the neighbours: one
+# read and one write of a double for the stencils, one write for the shock
+# wave (which reads nothing).
+BYTES_PER_CELL = {"heat": 16, "dispersion": 16, "shock": 8}
+
+# family, name, binary (relative to the build dir), kind, extra arguments.
+#   seq     single thread
+#   omp     OpenMP, threads from OMP_NUM_THREADS
+#   pool    thread pool, threads as the last argument
+#   mpi     one thread per rank
+#   hybrid  ranks x OpenMP threads
+VARIANTS = [
+    ("heat", "sequential", "1/sequential", "seq", []),
+    ("heat", "openmp", "1/openmp", "omp", []),
+    ("heat", "tiled", "1/tiled", "omp", []),
+    ("heat", "outofcore", "1/outofcore", "omp", []),
+    ("heat", "parareal", "1/parareal", "omp", []),
+    ("heat", "mpi-sync", "4/1/sync", "mpi", []),
+    ("heat", "mpi-async", "4/1/async", "mpi", []),
+    ("heat", "mpi-hybrid", "4/1/hybrid", "hybrid", []),
+    ("heat", "mpi-rma-pscw", "4/1/rma", "mpi", ["pscw"]),
+    ("heat", "mpi-rma-shared", "4/1/rma", "mpi", ["shared"]),
+    ("heat", "mpi-coro", "4/1/coro", "mpi", []),
+    ("dispersion", "sequential", "2/sequential", "seq", []),
+    ("dispersion", "parallel", "2/parallel", "mpi", []),
+    ("dispersion", "ensemble", "2/ensemble", "omp", []),
+    ("dispersion", "outofcore", "2/outofcore", "omp", []),
+    ("dispersion", "amr", "2/amr", "omp", []),
+    ("dispersion", "mpi-sync", "4/2/sync", "mpi", []),
+    ("dispersion", "mpi-async", "4/2/async", "mpi", []),
+    ("dispersion", "mpi-hybrid", "4/2/hybrid", "hybrid", []),
+    ("dispersion", "mpi-rma-pscw", "4/2/rma", "mpi", ["pscw"]),
+    ("dispersion", "mpi-rma-shared", "4/2/rma", "mpi", ["shared"]),
+    ("dispersion", "mpi-coro", "4/2/coro", "mpi", []),
+    ("shock", "sequential", "3/sequential", "seq", []),
+    ("shock", "threadpool", "3/threadpool", "pool", []),
+    ("shock", "mpi-sync", "4/3/sync", "mpi", []),
+    ("shock", "mpi-async", "4/3/async", "mpi", []),
+    ("shock", "mpi-dynamic", "4/3/dynamic", "mpi", []),
+]
+
+# Variants whose final field is not the sequential one's: 2/amr refines the
+# grid where the plume is. They are timed but not checked.
+UNCHECKED = {"dispersion/amr"}
+
+def int_list(text):
+    return [int(x) for x in text.split(",") if x]
+
+
+def build(build_dir, make_args):
+    cmd = ["make", "-s", "-j", str(os.cpu_count() or 1), "BUILD=" + build_dir] + make_args
+    print("+ " + " ".join(cmd), file=sys.stderr)
+    subprocess.run(cmd, cwd=ROOT, check=True)
+
+
+def generate_input(family, size, path):
+    """Writes a deterministic CSV input: a hot square on the 30.0 ambient for
+    heat, an initial contamination square at the centre for dispersion."""
+    if os.path.exists(path):
+        return
+    lo, hi = size // 2 - size // 10, size // 2 + size // 10
+    with open(path + ".tmp", "w") as f:
+        for i in range(size):
+            if family == "heat":
+                row = ["%.3f" % (30.0 + ((i * 7919 + j * 104729) % 1000) / 1000.0 + (600.0 if lo <= i < hi and lo <= j < hi else 0.0)) for j in range(size)]
+            else:
+                inside = lo <= i < hi
+                row = ["1000.0" if inside and lo <= j < hi else "0.0" for j in range(size)]
+            f.write(",".join(row) + "\n")
+    os.replace(path + ".tmp", path)
+
+
+def parse_time(stdout):
+    """The programs print their own elapsed time last, e.g. '0.83',
+    'Parallel: 0.83' or 'Dynamic MPI Time: 0.83 seconds (chunk 16 rows)'."""
+    lines = [l for l in stdout.strip().splitlines() if l.strip()]
+    if not lines:
+        return None
+    last = lines[-1]
+    if ":" in last:
+        last = last.rsplit(":", 1)[1]
+    m = re.search(r"[-+]?\d+(?:\.\d*)?(?:[eE][-+]?\d+)?", last)
+    return float(m.group(0)) if m else None
+
+
+def run_once(cmd, env, timeout):
+    start = time.perf_counter_ns()
+    proc = subprocess.run(cmd, env=env, capture_output=True, text=True, timeout=timeout)
+    wall = (time.perf_counter_ns() - start) / 1e9
+    if proc.returncode != 0:
+        raise RuntimeError("%s failed (%d): %s" % (" ".join(cmd), proc.returncode, proc.stderr.strip()[-500:]))
+    return parse_time(proc.stdout), wall
+
+
+def load_field(path):
+    data = array.array("d")
+    with open(path, "rb") as f:
+        data.frombytes(f.read())
+    return data
+
+
+def compare(out, ref, tol):
+    """Largest relative difference, |a - b| / max(1, |b|); NaN and infinities
+    must match exactly."""
+    if len(out) != len(ref):
+        return math.inf
+    worst = 0.0
+    for a, b in zip(out, ref):
+        if a == b or (a != a and b != b):
+            continue
+        if math.isinf(a) or math.isinf(b) or a != a or b != b:
+            return math.inf
+        d = abs(a - b) / max(1.0, abs(b))
+        if d > worst:
+            worst = d
+    return worst
+
+
+def configurations(kind, threads, ranks):
+    if kind == "seq":
+        return [(1, 1)]
+    if kind in ("omp", "pool"):
+        return [(t, 1) for t in threads]
+    if kind == "mpi":
+        return [(1, r) for r in ranks]
+    return [(t, r) for r in ranks for t in threads]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--sizes", type=int_list, default=[512], help="grid sizes, comma separated")
+    ap.add_argument("--threads", type=int_list, default=[1, 2, 4], help="thread counts")
+    ap.add_argument("--ranks", type=int_list, default=[1, 2, 4], help="MPI rank counts")
+    ap.add_argument("--reps", type=int, default=3, help="timed repetitions per configuration")
+    ap.add_argument("--families", default="heat,dispersion,shock")
+    ap.add_argument("--variants", default=".*", help="regex on 'family/name'")
+    ap.add_argument("--mpirun", default="mpirun --oversubscribe", help="MPI launcher and its options")
+    ap.add_argument("--make-args", default="", help="extra make arguments, e.g. 'CXX=g++-15 ARCH='")
+    ap.add_argument("--build-root", default="build/bench")
+    ap.add_argument("--tol", type=float, default=1e-9, help="relative tolerance against the sequential output")
+    ap.add_argument("--no-check", action="store_true", help="skip the correctness runs")
+    ap.add_argument("--timeout", type=float, default=None, help="seconds per run")
+    ap.add_argument("--json", help="write results as JSON")
+    ap.add_argument("--csv", help="write results as CSV")
+    args = ap.parse_args()
+
+    families = set(args.families.split(","))
+    pattern = re.compile(args.variants)
+    mpirun = shlex.split(args.mpirun)
+    make_args = shlex.split(args.make_args)
+    results = []
+
+    build(args.build_root, make_args)
+    build_path = os.path.join(ROOT, args.build_root)
+    for size in args.sizes:
+        inputs = {}
+        for family in ("heat", "dispersion"):
+            if family in families:
+                inputs[family] = os.path.join(build_path, "%s-%d.csv" % (family, size))
+                generate_input(family, size, inputs[family])
+
+        references = {}
+        baseline = {}
+        with tempfile.TemporaryDirectory() as tmp:
+            for family, name, binary, kind, extra in VARIANTS:
+                if family not in families or not (kind == "seq" or pattern.search(family + "/" + name)):
+                    continue
+                for threads, ranks in configurations(kind, args.threads, args.ranks):
+                    record = {
+                        "family": family, "variant": name, "size": size,
+                        "threads": threads, "ranks": ranks, "steps": STEPS[family],
+                    }
+                    cmd = [os.path.join(build_path, binary)]
+                    if family in inputs:
+                        cmd.append(inputs[family])
+                    cmd += extra + ["--n", str(size)]
+                    if kind == "pool":
+                        cmd.append(str(threads))
+                    if kind in ("mpi", "hybrid"):
+                        cmd = mpirun + ["-np", str(ranks)] + cmd
+                    env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+                    env.pop("SIM_OUTPUT", None)
+
+                    label = "%s/%s n=%d t=%d r=%d" % (family, name, size, threads, ranks)
+                    try:
+                        if not args.no_check:
+                            out = os.path.join(tmp, "%s-%s-%d-%d.bin" % (family, name, threads, ranks))
+                            run_once(cmd, dict(env, SIM_OUTPUT=out), args.timeout)
+                            if kind == "seq":
+                                references[family] = out
+                            elif family in references and family + "/" + name not in UNCHECKED:
+                                err = compare(load_field(out), load_field(references[family]), args.tol)
+                                record["max_rel_error"] = err
+                                record["correct"] = err <= args.tol
+                        times, walls = [], []
+                        for _ in range(args.reps):
+                            t, w = run_once(cmd, env, args.timeout)
+                            times.append(t if t is not None else w)
+                            walls.append(w)
+                    except (RuntimeError, subprocess.TimeoutExpired) as e:
+                        record["status"] = "failed: %s" % e
+                        results.append(record)
+                        print("%-48s FAILED" % label, file=sys.stderr)
+                        continue
+
+                    median = statistics.median(times)
+                    cells = float(size) * size * STEPS[family]
+                    record.update({
+                        "status": "ok",
+                        "times": times,
+                        "wall_times": walls,
+                        "median": median,
+                        "min": min(times),
+                        "stddev": statistics.stdev(times) if len(times) > 1 else 0.0,
+                        "wall_median": statistics.median(walls),
+                        "cells_per_s": cells / median if median > 0 else None,
+                        "gb_per_s": cells * BYTES_PER_CELL[family] / median / 1e9 if median > 0 else None,
+                    })
+                    if kind == "seq":
+                        baseline[family] = median
+                    if family in baseline and median > 0:
+                        record["speedup"] = baseline[family] / median
+                        record["efficiency"] = record["speedup"] / (threads * ranks)
+                    results.append(record)
+                    print("%-48s median %.6f s  min %.6f s  sd %.6f  speedup %s  %s" % (
+                        label, median, record["min"], record["stddev"],
+                        "%.2fx" % record["speedup"] if "speedup" in record else "-",
+                        "" if "correct" not in record else ("ok" if record["correct"] else "MISMATCH %.3g" % record["max_rel_error"])),
+                        file=sys.stderr)
+
+    meta = {
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "processor": platform.processor(),
+        "cpus": os.cpu_count(),
+        "make_args": args.make_args,
+        "reps": args.reps,
+        "tolerance": args.tol,
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S"),
+    }
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"meta": meta, "results": results}, f, indent=2)
+    if args.csv:
+        fields = ["family", "variant", "size", "threads", "ranks", "steps", "status", "median", "min", "stddev",
+                  "wall_median", "speedup", "efficiency", "cells_per_s", "gb_per_s", "max_rel_error", "correct"]
+        with open(args.csv, "w", newline="") as f:
+            w = csv.DictWriter(f, fieldnames=fields, extrasaction="ignore")
+            w.writeheader()
+            for r in results:
+                w.writerow(r)
+
+    mismatches = [r for r in results if r.get("correct") is False or r.get("status", "").startswith("failed")]
+    return 1 if mismatches else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,27 @@
+#!/usr/bin/env python3
+"""Merges per-rank Chrome traces (SIM_TRACE=path gives path.0, path.1, ...)
+into one file, so all ranks share a timeline in chrome://tracing or
+ui.perfetto.dev. Each rank is already its own pid.
+
+    python3 bench/merge_traces.py trace.json.* > trace.json
+
+Only the standard library is needed.
+"""
+
+import json
+import sys
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: merge_traces.py TRACE...")
+    events = []
+    for path in sys.argv[1:]:
+        with open(path) as f:
+            events.extend(json.load(f)["traceEvents"])
+    json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, sys.stdout)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()
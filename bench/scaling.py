@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""Strong- and weak-scaling suite for the MPI variants on one machine.
+
+Runs 2/src/parallel and the 4/src sync/async binaries with mpirun
+--oversubscribe at every rank count, either at a fixed grid size (strong) or
+with the grid growing so every rank keeps the same number of cells (weak).
+The binaries are built once and given the size with --n; inputs are
+generated at run time. The first run of each configuration is untimed: it
+loads the PMPI library (tools/pmpi) to measure the loop's communication/
+compute split and writes the final field, which must match the 1-rank run of
+the same size. Then --reps timed runs give the median time, speedup and
+efficiency.
+
+    python3 bench/scaling.py --mode both --ranks 1,2,4,8 --size 1024 \\
+        --weak-size 512 --reps 3 --json scaling.json --csv scaling.csv
+
+Only the standard library is needed.
+"""
+
+import argparse
+import csv
+import json
+import math
+import os
+import platform
+import re
+import shlex
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import bench
+
+# family, name, binary (relative to the build dir).
+VARIANTS = [
+    ("heat", "mpi-sync", "4/1/sync"),
+    ("heat", "mpi-async", "4/1/async"),
+    ("dispersion", "parallel", "2/parallel"),
+    ("dispersion", "mpi-sync", "4/2/sync"),
+    ("dispersion", "mpi-async", "4/2/async"),
+    ("shock", "mpi-sync", "4/3/sync"),
+    ("shock", "mpi-async", "4/3/async"),
+]
+
+
+def weak_size(base, ranks):
+    """Grid edge that keeps at least base*base cells per rank."""
+    return int(math.ceil(base * math.sqrt(ranks)))
+
+
+def pmpi_split(path):
+    """Mean loop wall time, mean time inside MPI and compute imbalance
+    (max/mean of wall minus MPI) from a SIM_PMPI_CSV file."""
+    wall, mpi = {}, {}
+    with open(path) as f:
+        for row in csv.DictReader(f):
+            if row["phase"] not in ("loop", "all"):
+                continue
+            r = int(row["rank"])
+            if row["function"] == "wall":
+                wall[r] = float(row["seconds"])
+            else:
+                mpi[r] = mpi.get(r, 0.0) + float(row["seconds"])
+    if not wall:
+        return None
+    compute = [wall[r] - mpi.get(r, 0.0) for r in wall]
+    mean_wall = statistics.mean(wall.values())
+    mean_mpi = statistics.mean(mpi.get(r, 0.0) for r in wall)
+    mean_compute = statistics.mean(compute)
+    return {
+        "loop_wall": mean_wall,
+        "loop_mpi": mean_mpi,
+        "comm_fraction": mean_mpi / mean_wall if mean_wall > 0 else None,
+        "comm_compute_ratio": mean_mpi / mean_compute if mean_compute > 0 else None,
+        "imbalance": max(compute) / mean_compute if mean_compute > 0 else None,
+    }
+
+
+def mpi_env(template, name, value):
+    return [a.format(name=name, value=value) for a in shlex.split(template)]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--mode", choices=["strong", "weak", "both"], default="both")
+    ap.add_argument("--ranks", type=bench.int_list, default=[1, 2, 4, 8], help="rank counts, comma separated")
+    ap.add_argument("--size", type=int, default=1024, help="grid size for strong scaling")
+    ap.add_argument("--weak-size", type=int, default=512, help="grid size per rank at 1 rank for weak scaling")
+    ap.add_argument("--reps", type=int, default=3, help="timed repetitions per configuration")
+    ap.add_argument("--variants", default=".*", help="regex on 'family/name'")
+    ap.add_argument("--mpirun", default="mpirun --oversubscribe", help="MPI launcher and its options")
+    ap.add_argument("--mpi-env", default="-x {name}={value}",
+                    help="launcher option that exports a variable to the ranks (MPICH: '-genv {name} {value}')")
+    ap.add_argument("--make-args", default="", help="extra make arguments, e.g. 'CXX=g++-15 ARCH='")
+    ap.add_argument("--build-root", default="build/scaling")
+    ap.add_argument("--tol", type=float, default=1e-9, help="relative tolerance against the 1-rank output of the same size")
+    ap.add_argument("--no-pmpi", action="store_true", help="skip the profiled run")
+    ap.add_argument("--timeout", type=float, default=None, help="seconds per run")
+    ap.add_argument("--json", help="write results as JSON")
+    ap.add_argument("--csv", help="write results as CSV")
+    args = ap.parse_args()
+
+    pattern = re.compile(args.variants)
+    variants = [v for v in VARIANTS if pattern.search(v[0] + "/" + v[1])]
+    mpirun = shlex.split(args.mpirun)
+    make_args = shlex.split(args.make_args)
+    ranks = sorted(set(args.ranks))
+    modes = ["strong", "weak"] if args.mode == "both" else [args.mode]
+
+    plan = []
+    for mode in modes:
+        for r in ranks:
+            size = args.size if mode == "strong" else weak_size(args.weak_size, r)
+            plan.append((mode, r, size))
+    sizes = sorted({size for _, _, size in plan})
+    bench.build(args.build_root, make_args)
+    build_path = os.path.join(bench.ROOT, args.build_root)
+    for size in sizes:
+        for family in ("heat", "dispersion"):
+            bench.generate_input(family, size, os.path.join(build_path, "%s-%d.csv" % (family, size)))
+
+    results = []
+    with tempfile.TemporaryDirectory() as tmp:
+        for family, name, binary in variants:
+            references = {}
+            baseline = {}
+            for mode, r, size in plan:
+                record = {"mode": mode, "family": family, "variant": name, "ranks": r, "size": size,
+                          "cells_per_rank": size * size / r, "steps": bench.STEPS[family]}
+                exe = [os.path.join(build_path, binary)]
+                if family in ("heat", "dispersion"):
+                    exe.append(os.path.join(build_path, "%s-%d.csv" % (family, size)))
+                exe += ["--n", str(size)]
+                env = dict(os.environ, OMP_NUM_THREADS="1")
+                env.pop("SIM_OUTPUT", None)
+                label = "%s %s/%s n=%d r=%d" % (mode, family, name, size, r)
+                try:
+                    # Untimed: output check and, unless disabled, the PMPI
+                    # communication breakdown.
+                    out = os.path.join(tmp, "%s-%s-%d-%d.bin" % (family, name, size, r))
+                    profile = os.path.join(tmp, "%s-%s-%d-%d.csv" % (family, name, size, r))
+                    cmd = mpirun + ["-np", str(r)] + mpi_env(args.mpi_env, "SIM_OUTPUT", out)
+                    if not args.no_pmpi:
+                        cmd += mpi_env(args.mpi_env, "LD_PRELOAD", os.path.join(build_path, "tools", "libpmpi.so"))
+                        cmd += mpi_env(args.mpi_env, "SIM_PMPI_CSV", profile)
+                    bench.run_once(cmd + exe, env, args.timeout)
+                    if r == 1:
+                        references.setdefault(size, out)
+                    if size not in references:
+                        # Weak-scaling sizes have no 1-rank run of their own.
+                        ref = os.path.join(tmp, "%s-%s-%d-ref.bin" % (family, name, size))
+                        bench.run_once(mpirun + ["-np", "1"] + mpi_env(args.mpi_env, "SIM_OUTPUT", ref) + exe,
+                                       env, args.timeout)
+                        references[size] = ref
+                    if r != 1:
+                        err = bench.compare(bench.load_field(out), bench.load_field(references[size]), args.tol)
+                        record["max_rel_error"] = err
+                        record["correct"] = err <= args.tol
+                    if not args.no_pmpi and os.path.exists(profile):
+                        record.update(pmpi_split(profile) or {})
+
+                    times = []
+                    for _ in range(args.reps):
+                        t, w = bench.run_once(mpirun + ["-np", str(r)] + exe, env, args.timeout)
+                        times.append(t if t is not None else w)
+                except (RuntimeError, subprocess.TimeoutExpired) as e:
+                    record["status"] = "failed: %s" % e
+                    results.append(record)
+                    print("%-44s FAILED" % label, file=sys.stderr)
+                    continue
+
+                median = statistics.median(times)
+                record.update({"status": "ok", "times": times, "median": median, "min": min(times)})
+                if r == 1:
+                    baseline[mode] = median
+                if mode in baseline and median > 0:
+                    # Strong: T1 / (p Tp). Weak: T1 / Tp, the work per rank
+                    # being constant.
+                    record["speedup"] = baseline[mode] / median
+                    record["efficiency"] = record["speedup"] / r if mode == "strong" else record["speedup"]
+                results.append(record)
+                print("%-44s median %.6f s  eff %s  comm %s  %s" % (
+                    label, median,
+                    "%.2f" % record["efficiency"] if "efficiency" in record else "-",
+                    "%.0f%%" % (100 * record["comm_fraction"]) if record.get("comm_fraction") is not None else "-",
+                    "" if "correct" not in record else ("ok" if record["correct"] else "MISMATCH %.3g" % record["max_rel_error"])),
+                    file=sys.stderr)
+
+    # Efficiency curves, one block per mode and variant.
+    for mode in modes:
+        print("\n%s scaling" % mode)
+        print("%-24s %5s %6s %10s %7s %6s %7s %9s" % ("variant", "ranks", "N", "median s", "speedup", "eff", "comm%", "imbalance"))
+        for family, name, _ in variants:
+            for rec in results:
+                if rec["mode"] != mode or rec["family"] != family or rec["variant"] != name or rec.get("status") != "ok":
+                    continue
+                eff = rec.get("efficiency")
+                print("%-24s %5d %6d %10.6f %7s %6s %7s %9s  %s" % (
+                    family + "/" + name, rec["ranks"], rec["size"], rec["median"],
+                    "%.2f" % rec["speedup"] if "speedup" in rec else "-",
+                    "%.2f" % eff if eff is not None else "-",
+                    "%.1f" % (100 * rec["comm_fraction"]) if rec.get("comm_fraction") is not None else "-",
+                    "%.2f" % rec["imbalance"] if rec.get("imbalance") is not None else "-",
+                    "#" * int(round(20 * min(eff, 1.5))) if eff is not None else ""))
+
+    meta = {
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "processor": platform.processor(),
+        "cpus": os.cpu_count(),
+        "mpirun": args.mpirun,
+        "make_args": args.make_args,
+        "reps": args.reps,
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S"),
+    }
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"meta": meta, "results": results}, f, indent=2)
+    if args.csv:
+        fields = ["mode", "family", "variant", "ranks", "size", "cells_per_rank", "steps", "status", "median", "min",
+                  "speedup", "efficiency", "loop_wall", "loop_mpi", "comm_fraction", "comm_compute_ratio",
+                  "imbalance", "max_rel_error", "correct"]
+        with open(args.csv, "w", newline="") as f:
+            w = csv.DictWriter(f, fieldnames=fields, extrasaction="ignore")
+            w.writeheader()
+            for r in results:
+                w.writerow(r)
+
+    failures = [r for r in results if r.get("correct") is False or r.get("status", "").startswith("failed")]
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,251 @@
+#include "lib/sim.h"
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include <omp.h>
+#include "shared/params.h"
+#include "shared/stencil.h"
+
+// The stencils of shared/stencil.h and the shock kernel of
+// 3/src/sequential.cpp on run-time parameters, with the same arithmetic so
+// results match the executables bit for bit.
+
+namespace
+{
+    thread_local std::string last_error;
+
+    int fail(const std::string &message)
+    {
+        last_error = message;
+        return 1;
+    }
+
+    constexpr double SHOCK_COEFFS[9] = {2.611369, -1.690128, 0.00805, 0.336743, -0.005162, -0.080923, -0.004785, 0.007930, 0.000768};
+}
+
+struct sim
+{
+    sim_kind kind;
+    sim_params p;
+    int t = 0;
+    int stride; // row stride of grid and next
+    int offset; // index of cell (0, 0)
+    std::vector<double> grid;
+    std::vector<double> next;
+
+    int threads() const { return p.threads > 0 ? p.threads : omp_get_max_threads(); }
+
+    void heat_step()
+    {
+        const int N = p.n;
+        const int W = stride;
+        const int tile_i = p.tile_i;
+        const int tile_j = p.tile_j;
+        const stencil::Heat heat(static_cast<const double *>(p.kernel));
+        const double *g = grid.data();
+        double *out = next.data();
+#pragma omp parallel for collapse(2) schedule(static) num_threads(threads())
+        for (int ti = 1; ti <= N; ti += tile_i)
+        {
+            for (int tj = 1; tj <= N; tj += tile_j)
+            {
+                int i_end = std::min(ti + tile_i, N + 1);
+                int j_end = std::min(tj + tile_j, N + 1);
+                for (int i = ti; i < i_end; i++)
+                    stencil::row(heat, g, out, W, i, tj, j_end);
+            }
+        }
+        std::swap(grid, next);
+    }
+
+    int dispersion_step()
+    {
+        const int N = p.n;
+        const int W = stride;
+        const stencil::Dispersion dispersion(p);
+        const double *g = grid.data();
+        double *out = next.data();
+        int uncontaminated = 0;
+#pragma omp parallel for schedule(static) reduction(+ : uncontaminated) num_threads(threads())
+        for (int i = 1; i <= N; i++)
+            uncontaminated += stencil::row(dispersion, g, out, W, i, 1, N + 1);
+        std::swap(grid, next);
+        return uncontaminated;
+    }
+
+    // Updated in place: a cell only depends on its distance and the time.
+    void shock_step()
+    {
+        const int N = p.n;
+        const int CENTER_X = N / 2;
+        const int CENTER_Y = N / 2;
+        const double W = p.yield;
+        const double CELL_SIZE = p.cell_size;
+        const int time = t;
+        double *g = grid.data();
+#pragma omp parallel for schedule(static) num_threads(threads())
+        for (int i = 0; i < N; i++)
+        {
+            for (int j = 0; j < N; j++)
+            {
+                double di = i - CENTER_X;
+                double dj = j - CENTER_Y;
+                double R = sqrt(di * di + dj * dj) * CELL_SIZE;
+
+                if (time >= R / 343.0)
+                {
+                    double Z = R * pow(W, -1.0 / 3.0);
+                    double U = -0.21436 + 1.35034 * log10(Z);
+                    double log10P = 0.0;
+                    for (int k = 0; k < 9; k++)
+                    {
+                        log10P += SHOCK_COEFFS[k] * pow(U, k);
+                    }
+                    g[(size_t)i * N + j] = pow(10.0, log10P);
+                }
+            }
+        }
+    }
+};
+
+extern "C"
+{
+    void sim_default_params(int n, sim_params *p)
+    {
+        *p = sim_params{};
+        p->n = n;
+        p->tile_i = heat::TILE_SIZE;
+        p->tile_j = heat::TILE_SIZE;
+        std::copy(&heat::KERNEL[0][0], &heat::KERNEL[0][0] + 9, p->kernel);
+        p->time_step = dispersion::TIME_STEP;
+        p->dx = dispersion::DX;
+        p->dy = dispersion::DY;
+        p->diffusion = dispersion::DIFFUSION_COEFF;
+        p->decay = dispersion::DECAY_RATE;
+        p->deposition = dispersion::DEPOSITION_RATE;
+        p->wind_x = dispersion::WIND_X;
+        p->wind_y = dispersion::WIND_Y;
+        p->yield = shock::W;
+        p->cell_size = shock::CELL_SIZE;
+    }
+
+    sim *sim_create(sim_kind kind, const sim_params *p, const double *initial)
+    {
+        if (p == nullptr || p->n < 1 || p->threads < 0)
+        {
+            fail("n must be positive and threads not negative");
+            return nullptr;
+        }
+        if (kind == SIM_HEAT && (p->tile_i < 1 || p->tile_j < 1))
+        {
+            fail("tile sizes must be positive");
+            return nullptr;
+        }
+        if (kind == SIM_DISPERSION && (p->time_step <= 0 || p->dx <= 0 || p->dy <= 0))
+        {
+            fail("time_step, dx and dy must be positive");
+            return nullptr;
+        }
+        if (kind == SIM_DISPERSION && !fits_int_counts(p->n))
+        {
+            fail("n must be at most 46340 for dispersion, whose counts are ints");
+            return nullptr;
+        }
+        if (kind == SIM_SHOCK && (p->yield <= 0 || p->cell_size <= 0))
+        {
+            fail("yield and cell_size must be positive");
+            return nullptr;
+        }
+        if (kind != SIM_HEAT && kind != SIM_DISPERSION && kind != SIM_SHOCK)
+        {
+            fail("unknown simulation kind");
+            return nullptr;
+        }
+
+        sim *s = new (std::nothrow) sim;
+        if (s == nullptr)
+        {
+            fail("out of memory");
+            return nullptr;
+        }
+        s->kind = kind;
+        s->p = *p;
+        const int N = p->n;
+        try
+        {
+            // Heat and dispersion keep a ring of fixed boundary cells.
+            double fill = kind == SIM_HEAT ? stencil::Heat::BOUNDARY : stencil::Dispersion::BOUNDARY;
+            s->stride = kind == SIM_SHOCK ? N : N + 2;
+            s->offset = kind == SIM_SHOCK ? 0 : N + 3;
+            size_t cells = (size_t)s->stride * (kind == SIM_SHOCK ? N : N + 2);
+            s->grid.assign(cells, fill);
+            if (kind != SIM_SHOCK)
+                s->next.assign(cells, fill);
+        }
+        catch (const std::bad_alloc &)
+        {
+            delete s;
+            fail("out of memory");
+            return nullptr;
+        }
+        if (initial != nullptr)
+        {
+            for (int i = 0; i < N; i++)
+                std::copy(initial + (size_t)i * N, initial + (size_t)(i + 1) * N,
+                          s->grid.data() + s->offset + (size_t)i * s->stride);
+        }
+        return s;
+    }
+
+    void sim_destroy(sim *s)
+    {
+        delete s;
+    }
+
+    int sim_step(sim *s, int steps, int *counts)
+    {
+        if (s == nullptr || steps < 0)
+            return fail("sim_step needs a simulation and a non-negative step count");
+        for (int i = 0; i < steps; i++)
+        {
+            switch (s->kind)
+            {
+            case SIM_HEAT:
+                s->heat_step();
+                break;
+            case SIM_DISPERSION:
+            {
+                int count = s->dispersion_step();
+                if (counts != nullptr)
+                    counts[i] = count;
+                break;
+            }
+            case SIM_SHOCK:
+                s->shock_step();
+                break;
+            }
+            s->t++;
+        }
+        return 0;
+    }
+
+    int sim_time(const sim *s)
+    {
+        return s->t;
+    }
+
+    const double *sim_field(const sim *s, int *row_stride)
+    {
+        if (row_stride != nullptr)
+            *row_stride = s->stride;
+        return s->grid.data() + s->offset;
+    }
+
+    const char *sim_error(void)
+    {
+        return last_error.c_str();
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef LIB_SIM_H
+#define LIB_SIM_H
+
+/* The heat (1/), dispersion (2/) and shock (3/) kernels as a library, for
+ * callers that run many simulations in one process instead of starting an
+ * executable per run:
+ *
+ *   make lib        builds build/lib/libsim.so
+ *
+ *   sim_params p;
+ *   sim_default_params(n, &p);
+ *   sim *s = sim_create(SIM_HEAT, &p, grid);      copies the n x n grid
+ *   sim_step(s, 100, NULL);
+ *   int stride;
+ *   const double *f = sim_field(s, &stride);      row i is f + i * stride
+ *   sim_destroy(s);
+ *
+ * Steps run on the OpenMP thread team, which the runtime keeps alive between
+ * calls, so only the first call of a process pays for thread creation.
+ * Functions return 0 or a non-NULL pointer on success; sim_error() then
+ * describes the last failure of the calling thread. A sim may be used by one
+ * thread at a time; separate sims are independent. */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct sim sim;
+
+    typedef enum
+    {
+        SIM_HEAT,
+        SIM_DISPERSION,
+        SIM_SHOCK
+    } sim_kind;
+
+    /* sim_default_params fills in the defaults of shared/params.h; each kind
+     * ignores the fields of the others. */
+    typedef struct
+    {
+        int n;       /* grid rows and columns */
+        int threads; /* 0 for the OpenMP default */
+        int tile_i;  /* heat tile rows and columns */
+        int tile_j;
+        double kernel[9]; /* heat, row-major 3 x 3 */
+        double time_step; /* dispersion */
+        double dx;
+        double dy;
+        double diffusion;
+        double decay;
+        double deposition;
+        double wind_x;
+        double wind_y;
+        double yield; /* shock */
+        double cell_size;
+    } sim_params;
+
+    void sim_default_params(int n, sim_params *p);
+
+    /* initial is n x n row-major doubles and is copied; NULL starts from the
+     * programs' initial value (30 for heat, 0 otherwise). */
+    sim *sim_create(sim_kind kind, const sim_params *p, const double *initial);
+    void sim_destroy(sim *s);
+
+    /* Advances steps time steps. For dispersion, counts (may be NULL)
+     * receives the number of uncontaminated cells after each of them. */
+    int sim_step(sim *s, int steps, int *counts);
+
+    /* Time steps done so far. */
+    int sim_time(const sim *s);
+
+    /* The current field without a copy: n rows of n doubles, row i starting
+     * at the returned pointer + i * *row_stride. Valid until the next
+     * sim_step or sim_destroy. */
+    const double *sim_field(const sim *s, int *row_stride);
+
+    const char *sim_error(void);
+
+#ifdef __cplusplus
+}
+
+#include <stdexcept>
+
+namespace sim_cpp
+{
+    // Owning wrapper that throws std::runtime_error on failure.
+    class Simulation
+    {
+    public:
+        Simulation(sim_kind kind, const sim_params &p, const double *initial = nullptr)
+            : s(sim_create(kind, &p, initial))
+        {
+            if (s == nullptr)
+                throw std::runtime_error(sim_error());
+        }
+        ~Simulation() { sim_destroy(s); }
+        Simulation(const Simulation &) = delete;
+        Simulation &operator=(const Simulation &) = delete;
+
+        void step(int steps, int *counts = nullptr)
+        {
+            if (sim_step(s, steps, counts) != 0)
+                throw std::runtime_error(sim_error());
+        }
+        int time() const { return sim_time(s); }
+        const double *field(int &row_stride) const { return sim_field(s, &row_stride); }
+
+    private:
+        sim *s;
+    };
+}
+#endif
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef SHARED_AUTOTUNE_H
+#define SHARED_AUTOTUNE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <omp.h>
+#include <unistd.h>
+
+// Auto-tuning of the OpenMP heat kernels.
+//
+//   build/1/tiled in.csv --tune search   calibrate, cache and run
+//   build/1/tiled in.csv --tune auto     use the cached setting, calibrate
+//                                        on a miss
+//
+// The search times a few steps of the real kernel for each candidate,
+// one knob at a time starting from the current setting: thread count, tile
+// rows, tile columns, then schedule and chunk. The winner is stored per
+// host, CPU model, program and grid size in SIM_TUNE_CACHE (default
+// .sim_tune in the working directory), one line per entry, so the search
+// runs once per machine. The loops use schedule(runtime), which is how the
+// chosen schedule reaches them. None of the knobs changes the result.
+namespace tune
+{
+    struct Setting
+    {
+        int threads = 1;
+        int tile_i = 0; // 0 for kernels without tiles
+        int tile_j = 0;
+        omp_sched_t kind = omp_sched_static;
+        int chunk = 0; // 0 is the schedule's default
+    };
+
+    inline const char *kind_name(omp_sched_t kind)
+    {
+        switch (kind)
+        {
+        case omp_sched_dynamic:
+            return "dynamic";
+        case omp_sched_guided:
+            return "guided";
+        default:
+            return "static";
+        }
+    }
+
+    inline std::string describe(const Setting &s)
+    {
+        char buf[128];
+        if (s.tile_i > 0)
+            std::snprintf(buf, sizeof(buf), "%d threads, %dx%d tiles, schedule(%s, %d)",
+                          s.threads, s.tile_i, s.tile_j, kind_name(s.kind), s.chunk);
+        else
+            std::snprintf(buf, sizeof(buf), "%d threads, schedule(%s, %d)", s.threads, kind_name(s.kind), s.chunk);
+        return buf;
+    }
+
+    inline void apply(const Setting &s)
+    {
+        omp_set_num_threads(s.threads);
+        omp_set_schedule(s.kind, s.chunk);
+    }
+
+    inline std::string cpu_model()
+    {
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuinfo, line))
+        {
+            if (line.compare(0, 10, "model name") == 0)
+            {
+                size_t colon = line.find(':');
+                if (colon != std::string::npos)
+                    return line.substr(line.find_first_not_of(' ', colon + 1));
+            }
+        }
+        return "unknown cpu";
+    }
+
+    inline std::string host()
+    {
+        char name[256] = "";
+        gethostname(name, sizeof(name) - 1);
+        return name;
+    }
+
+    class Tuner
+    {
+    public:
+        Tuner(const char *program, int n)
+            : n(n)
+        {
+            const char *env = std::getenv("SIM_TUNE_CACHE");
+            path = env != nullptr && *env != '\0' ? env : ".sim_tune";
+            key = host() + "|" + cpu_model() + "|" + program + "|" + std::to_string(n);
+        }
+
+        // Fills s from the cache; false on a miss.
+        bool cached(Setting &s) const
+        {
+            std::ifstream file(path);
+            std::string line;
+            bool found = false;
+            while (std::getline(file, line))
+            {
+                size_t tab = line.find('\t');
+                if (tab == std::string::npos || line.compare(0, tab, key) != 0)
+                    continue;
+                std::istringstream ss(line.substr(tab + 1));
+                std::string kind;
+                Setting e;
+                if (ss >> e.threads >> e.tile_i >> e.tile_j >> kind >> e.chunk)
+                {
+                    e.kind = kind == "dynamic" ? omp_sched_dynamic : kind == "guided" ? omp_sched_guided
+                                                                                       : omp_sched_static;
+                    s = e;
+                    found = true; // the last entry wins
+                }
+            }
+            if (found)
+                std::fprintf(stderr, "[tune] cached: %s\n", describe(s).c_str());
+            return found;
+        }
+
+        // step(s) runs one time step with s applied. Every candidate gets a
+        // warm-up step and is scored by the faster of two timed ones.
+        template <typename Step>
+        Setting search(Setting best, Step step)
+        {
+            double best_time = measure(best, step);
+            std::fprintf(stderr, "[tune] start %-48s %.3f ms/step\n", describe(best).c_str(), best_time * 1e3);
+            auto consider = [&](Setting s)
+            {
+                if (s.threads == best.threads && s.tile_i == best.tile_i && s.tile_j == best.tile_j &&
+                    s.kind == best.kind && s.chunk == best.chunk)
+                    return;
+                double t = measure(s, step);
+                if (t < best_time)
+                {
+                    best = s;
+                    best_time = t;
+                    std::fprintf(stderr, "[tune] best  %-48s %.3f ms/step\n", describe(best).c_str(), best_time * 1e3);
+                }
+            };
+
+            int procs = omp_get_num_procs();
+            for (int t = 1; t < procs; t *= 2)
+                consider(with(best, &Setting::threads, t));
+            consider(with(best, &Setting::threads, procs));
+
+            if (best.tile_i > 0)
+            {
+                for (int ti : {8, 16, 32, 64, 128, 256})
+                    consider(with(best, &Setting::tile_i, std::min(ti, n)));
+                for (int tj : {16, 32, 64, 128, 256, 512, n})
+                    consider(with(best, &Setting::tile_j, std::min(tj, n)));
+            }
+
+            const std::pair<omp_sched_t, int> schedules[] = {
+                {omp_sched_static, 0}, {omp_sched_static, 1}, {omp_sched_static, 16},
+                {omp_sched_dynamic, 1}, {omp_sched_dynamic, 4}, {omp_sched_dynamic, 16},
+                {omp_sched_guided, 1}, {omp_sched_guided, 4}};
+            for (const auto &sc : schedules)
+            {
+                Setting s = best;
+                s.kind = sc.first;
+                s.chunk = sc.second;
+                consider(s);
+            }
+
+            store(best, best_time);
+            apply(best);
+            return best;
+        }
+
+    private:
+        int n;
+        std::string path;
+        std::string key;
+
+        static Setting with(Setting s, int Setting::*field, int value)
+        {
+            s.*field = value;
+            return s;
+        }
+
+        template <typename Step>
+        static double measure(const Setting &s, Step &step)
+        {
+            apply(s);
+            step(s);
+            double best = 0;
+            for (int r = 0; r < 2; r++)
+            {
+                double t0 = omp_get_wtime();
+                step(s);
+                double t = omp_get_wtime() - t0;
+                best = r == 0 ? t : std::min(best, t);
+            }
+            return best;
+        }
+
+        void store(const Setting &s, double seconds) const
+        {
+            std::FILE *f = std::fopen(path.c_str(), "a");
+            if (f == nullptr)
+            {
+                std::fprintf(stderr, "Failed to open tune cache %s\n", path.c_str());
+                return;
+            }
+            std::fprintf(f, "%s\t%d %d %d %s %d %.6g\n", key.c_str(), s.threads, s.tile_i, s.tile_j,
+                         kind_name(s.kind), s.chunk, seconds);
+            std::fclose(f);
+            std::fprintf(stderr, "[tune] stored in %s\n", path.c_str());
+        }
+    };
+
+    // Applies the cached or searched setting according to mode (off, auto
+    // or search) and returns it; with mode off, s itself is applied.
+    template <typename Step>
+    Setting run(const std::string &mode, const char *program, int n, Setting s, Step step)
+    {
+        if (mode == "off")
+        {
+            apply(s);
+            return s;
+        }
+        Tuner tuner(program, n);
+        if (mode == "auto" && tuner.cached(s))
+        {
+            apply(s);
+            return s;
+        }
+        return tuner.search(s, step);
+    }
+}
+
+#endif
@@ -0,0 +1,428 @@
+#ifndef SHARED_CHECKPOINT_H
+#define SHARED_CHECKPOINT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shared/partition.h"
+#include "shared/trace.h"
+
+// Checkpoint/restart of a time-stepped field.
+//
+//   SIM_CHECKPOINT=ckpt/heat build/1/tiled in.csv
+//                          writes ckpt/heat.<step>.ckpt; rerunning the same
+//                          command resumes from the newest one
+//   SIM_CHECKPOINT_EVERY   steps between checkpoints, or auto (default)
+//   SIM_CHECKPOINT_MTBF    expected seconds between failures for auto
+//                          (default 3600)
+//
+// With auto, the interval follows Young's rule, sqrt(2 * C * MTBF), where C
+// is the measured time to write one checkpoint and the step time converts it
+// to steps. The first checkpoint, after step 1, is written synchronously to
+// measure C; every later one is copied into a buffer in the step loop and
+// written by a background thread. Files are written under a temporary name
+// and renamed, and the previous checkpoint is only removed once every rank
+// has finished the next one, so a crash at any point leaves a complete
+// checkpoint behind. Restart reads the rows in parallel (OpenMP threads, or
+// one file per rank in MPI programs, .ckpt.<rank>). A successful run
+// removes its checkpoints.
+//
+// A checkpoint holds the field, the step count and the caller's statistics
+// (ints, e.g. per-step counts). It is only resumed by the same program with
+// the same grid size, step count limit and rank count; other parameters are
+// not recorded, so change them only with a fresh SIM_CHECKPOINT prefix.
+namespace checkpoint
+{
+    struct Header
+    {
+        char magic[8] = {'S', 'I', 'M', 'C', 'K', 'P', 'T', '1'};
+        char program[40] = {};
+        int32_t step = 0;
+        int32_t n_rows = 0;
+        int32_t cols = 0;
+        int32_t first_row = 0;
+        int32_t rows = 0;
+        int32_t ranks = 1;
+        int32_t stats = 0; // int32 statistics after the field
+        int32_t reserved = 0;
+    };
+
+    // Element-wise minimum of count ints over all ranks; empty for one
+    // process.
+    using Agree = std::function<void(int *, int)>;
+
+    class State
+    {
+    public:
+        // A field of n_rows x cols cells of which this process holds rows
+        // [first_row, first_row + rows). rank >= 0 adds the rank suffix.
+        State(const char *program, int n_rows, int cols, int max_steps, int first_row = 0, int rows = -1,
+              int rank = -1, int ranks = 1, Agree agree = nullptr)
+            : max_steps(max_steps), rank(rank), agree(agree)
+        {
+            std::strncpy(header.program, program, sizeof(header.program) - 1);
+            header.n_rows = n_rows;
+            header.cols = cols;
+            header.first_row = first_row;
+            header.rows = rows < 0 ? n_rows : rows;
+            header.ranks = ranks;
+
+            const char *p = std::getenv("SIM_CHECKPOINT");
+            if (p == nullptr || *p == '\0')
+                return;
+            prefix = p;
+            const char *every = std::getenv("SIM_CHECKPOINT_EVERY");
+            if (every != nullptr && *every != '\0' && std::string(every) != "auto")
+                fixed = std::max(1, std::atoi(every));
+            const char *mtbf_env = std::getenv("SIM_CHECKPOINT_MTBF");
+            if (mtbf_env != nullptr && *mtbf_env != '\0')
+                mtbf = std::max(1.0, std::atof(mtbf_env));
+            next = fixed > 0 ? fixed : 1;
+            field.resize((size_t)header.rows * cols);
+            on = true;
+            worker = std::thread(&State::run, this);
+        }
+
+        ~State()
+        {
+            if (!on)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                done = true;
+            }
+            cv.notify_all();
+            worker.join();
+        }
+
+        bool enabled() const { return on; }
+
+        // Loads the newest checkpoint every rank has into row(i) (local row
+        // i) and stats, and returns its step; 0 when starting fresh. A
+        // collective call in MPI programs.
+        template <typename RowFn>
+        int restore(RowFn row, int *stats = nullptr, int max_stats = 0)
+        {
+            if (!on)
+                return 0;
+            // Files of another program or layout under the same prefix are
+            // left alone.
+            std::vector<int> steps;
+            for (int s : own_steps())
+            {
+                Header h;
+                if (read_header(path(s), h) && matches(h, max_stats))
+                    steps.push_back(s);
+            }
+            int v = steps.empty() ? 0 : steps.back();
+            sync(&v, 1);
+            int step = v;
+
+            int ok = step > 0 ? load(step, max_stats) : 0;
+            sync(&ok, 1);
+            if (step > 0 && ok)
+            {
+                for (int i = 0; i < header.rows; i++)
+                    std::memcpy(row(i), field.data() + (size_t)i * header.cols, header.cols * sizeof(double));
+                if (stats != nullptr)
+                    std::copy(saved_stats.begin(), saved_stats.end(), stats);
+                std::fprintf(stderr, "[checkpoint] resumed %s at step %d\n", header.program, step);
+                written = {step};
+            }
+            else
+            {
+                step = 0;
+            }
+            for (int s : steps)
+            {
+                if (s != step)
+                    std::remove(path(s).c_str());
+            }
+            last_step = step;
+            last_time = std::chrono::steady_clock::now();
+            if (fixed > 0)
+                next = step + fixed;
+            else
+                next = step + 1;
+            return step;
+        }
+
+        bool due(int t) const { return on && t == next; }
+
+        // Call after time step t (1-based count of completed steps) with the
+        // state after it. Only does work when due(t), and is then a
+        // collective call in MPI programs.
+        template <typename RowFn>
+        void step(int t, RowFn row, const int *stats = nullptr, int count = 0)
+        {
+            if (!due(t))
+                return;
+            auto now = std::chrono::steady_clock::now();
+            double step_time = std::chrono::duration<double>(now - last_time).count() / std::max(1, t - last_step);
+            last_step = t;
+
+            {
+                trace::Span span("checkpoint", "io", t);
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&]
+                        { return !pending; });
+                for (int i = 0; i < header.rows; i++)
+                    std::memcpy(field.data() + (size_t)i * header.cols, row(i), header.cols * sizeof(double));
+                saved_stats.assign(stats, stats + count);
+                header.step = t;
+                header.stats = count;
+                pending = true;
+                cv.notify_all();
+                // Nothing measured yet: wait for this one to know its cost.
+                if (fixed == 0 && cost < 0)
+                    cv.wait(lock, [&]
+                            { return !pending; });
+            }
+
+            // v[0]: newest step this rank has on disk (-1 after a failed
+            // write), v[1]: steps to the next checkpoint.
+            int v[2] = {-1, fixed};
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (ok)
+                    v[0] = completed;
+                if (fixed == 0)
+                {
+                    double seconds = std::sqrt(2 * std::max(cost, 0.0) * mtbf);
+                    v[1] = (int)std::min(1e9, std::max(1.0, std::round(seconds / std::max(step_time, 1e-9))));
+                }
+            }
+            sync(v, 2);
+            if (v[0] > 0)
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                auto old = std::remove_if(written.begin(), written.end(), [&](int s)
+                                          {
+                                              if (s >= v[0])
+                                                  return false;
+                                              std::remove(path(s).c_str());
+                                              return true; });
+                written.erase(old, written.end());
+            }
+            next = t + v[1];
+            last_time = std::chrono::steady_clock::now();
+        }
+
+        // Removes this rank's checkpoints once the run has finished.
+        void finish()
+        {
+            if (!on)
+                return;
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&]
+                    { return !pending; });
+            for (int s : written)
+                std::remove(path(s).c_str());
+            written.clear();
+            if (cost >= 0)
+                std::fprintf(stderr, "[checkpoint] last write took %.3f s\n", cost);
+        }
+
+    private:
+        bool on = false;
+        std::string prefix;
+        int fixed = 0; // 0 for auto
+        double mtbf = 3600;
+        int max_steps;
+        int rank;
+        Agree agree;
+
+        Header header;
+        std::vector<double> field;
+        std::vector<int> saved_stats;
+        int next = 1;
+        int last_step = 0;
+        std::chrono::steady_clock::time_point last_time = std::chrono::steady_clock::now();
+
+        // Shared with the writer thread.
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool pending = false;
+        bool done = false;
+        bool ok = true;
+        int completed = -1;
+        double cost = -1; // seconds for the last write
+        std::vector<int> written;
+        std::thread worker;
+
+        void sync(int *v, int count)
+        {
+            if (agree)
+                agree(v, count);
+        }
+
+        std::string path(int step) const
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), ".%06d.ckpt", step);
+            std::string p = prefix + name;
+            if (rank >= 0)
+                p += "." + std::to_string(rank);
+            return p;
+        }
+
+        // Steps of this rank's checkpoint files, ascending.
+        std::vector<int> own_steps() const
+        {
+            namespace fs = std::filesystem;
+            fs::path base(prefix);
+            fs::path dir = base.parent_path().empty() ? fs::path(".") : base.parent_path();
+            std::string stem = base.filename().string() + ".";
+            std::string suffix = rank >= 0 ? ".ckpt." + std::to_string(rank) : ".ckpt";
+            std::vector<int> steps;
+            std::error_code ec;
+            for (const auto &entry : fs::directory_iterator(dir, ec))
+            {
+                std::string name = entry.path().filename().string();
+                if (name.size() <= stem.size() + suffix.size() || name.compare(0, stem.size(), stem) != 0 ||
+                    name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+                    continue;
+                std::string digits = name.substr(stem.size(), name.size() - stem.size() - suffix.size());
+                if (digits.find_first_not_of("0123456789") == std::string::npos)
+                    steps.push_back(std::atoi(digits.c_str()));
+            }
+            std::sort(steps.begin(), steps.end());
+            return steps;
+        }
+
+        static bool read_header(const std::string &p, Header &h)
+        {
+            std::FILE *f = std::fopen(p.c_str(), "rb");
+            if (f == nullptr)
+                return false;
+            bool ok = std::fread(&h, sizeof(h), 1, f) == 1;
+            std::fclose(f);
+            return ok;
+        }
+
+        bool matches(const Header &h, int max_stats) const
+        {
+            return std::memcmp(h.magic, header.magic, sizeof(h.magic)) == 0 &&
+                   std::strncmp(h.program, header.program, sizeof(h.program)) == 0 && h.n_rows == header.n_rows &&
+                   h.cols == header.cols && h.first_row == header.first_row && h.rows == header.rows &&
+                   h.ranks == header.ranks && h.step > 0 && h.step <= max_steps && h.stats >= 0 &&
+                   h.stats <= max_stats;
+        }
+
+        // Reads step's field into the buffer, rows split across threads.
+        int load(int step, int max_stats)
+        {
+            std::string p = path(step);
+            Header h;
+            if (!read_header(p, h) || !matches(h, max_stats) || h.step != step)
+                return 0;
+            int fd = open(p.c_str(), O_RDONLY);
+            if (fd < 0)
+                return 0;
+            const size_t row_bytes = (size_t)h.cols * sizeof(double);
+            auto read_row = [&](int i)
+            {
+                off_t offset = sizeof(Header) + (off_t)i * row_bytes;
+                return pread(fd, field.data() + (size_t)i * h.cols, row_bytes, offset) == (ssize_t)row_bytes;
+            };
+            int bad = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+ : bad)
+            for (int i = 0; i < h.rows; i++)
+                bad += !read_row(i);
+#else
+            // Programs built without OpenMP split the rows over plain threads.
+            const int threads = std::max(1, std::min<int>(std::thread::hardware_concurrency(), h.rows));
+            std::vector<int> failed(threads);
+            std::vector<std::thread> readers;
+            for (int t = 0; t < threads; t++)
+            {
+                readers.emplace_back([&, t]
+                                     {
+                    int first = block_start(h.rows, threads, t);
+                    for (int i = first; i < first + block_rows(h.rows, threads, t); i++)
+                        failed[t] += !read_row(i); });
+            }
+            for (auto &r : readers)
+                r.join();
+            for (int f : failed)
+                bad += f;
+#endif
+            saved_stats.resize(h.stats);
+            size_t stat_bytes = (size_t)h.stats * sizeof(int32_t);
+            off_t offset = sizeof(Header) + (off_t)h.rows * row_bytes;
+            if (stat_bytes > 0 && pread(fd, saved_stats.data(), stat_bytes, offset) != (ssize_t)stat_bytes)
+                bad++;
+            close(fd);
+            return bad == 0;
+        }
+
+        void run()
+        {
+            trace::name_thread("checkpoint writer");
+            std::unique_lock<std::mutex> lock(mtx);
+            while (true)
+            {
+                cv.wait(lock, [&]
+                        { return pending || done; });
+                if (!pending)
+                    return;
+                // The step loop does not touch the buffer while pending.
+                lock.unlock();
+                auto t0 = std::chrono::steady_clock::now();
+                bool wrote = write();
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                lock.lock();
+                ok = wrote;
+                if (wrote)
+                {
+                    completed = header.step;
+                    written.push_back(header.step);
+                    cost = seconds;
+                }
+                pending = false;
+                cv.notify_all();
+            }
+        }
+
+        bool write()
+        {
+            trace::Span span("write checkpoint", "io", header.step);
+            std::string final_path = path(header.step);
+            std::string tmp = final_path + ".tmp";
+            std::FILE *f = std::fopen(tmp.c_str(), "wb");
+            if (f == nullptr)
+            {
+                std::fprintf(stderr, "Failed to open checkpoint %s\n", tmp.c_str());
+                return false;
+            }
+            bool good = std::fwrite(&header, sizeof(header), 1, f) == 1 &&
+                        std::fwrite(field.data(), sizeof(double), field.size(), f) == field.size() &&
+                        std::fwrite(saved_stats.data(), sizeof(int32_t), saved_stats.size(), f) == saved_stats.size();
+            good = std::fflush(f) == 0 && fsync(fileno(f)) == 0 && good;
+            good = std::fclose(f) == 0 && good;
+            if (!good || std::rename(tmp.c_str(), final_path.c_str()) != 0)
+            {
+                std::fprintf(stderr, "Failed to write checkpoint %s\n", final_path.c_str());
+                std::remove(tmp.c_str());
+                return false;
+            }
+            return true;
+        }
+    };
+}
+
+#endif
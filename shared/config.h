@@ -0,0 +1,225 @@
+#ifndef SHARED_CONFIG_H
+#define SHARED_CONFIG_H
+
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Run-time parameters from the command line and config files.
+//
+//   ./tiled input.csv --n 2000 --steps 500 --tile 32
+//   ./tiled input.csv --config heat.cfg --steps=50
+//
+// A config file holds one "key = value" per line, # starts a comment. Keys
+// are applied in order, so later ones (files included) win. Arguments that
+// do not start with -- are positional and come back through argc()/argv()
+// with the program name in front, so the programs keep using argv[1].
+class Config
+{
+public:
+    Config(int argc, char *argv[])
+    {
+        positional.push_back(argv[0]);
+        for (int i = 1; i < argc; i++)
+        {
+            std::string a = argv[i];
+            if (a.size() < 3 || a.compare(0, 2, "--") != 0)
+            {
+                positional.push_back(argv[i]);
+                continue;
+            }
+            std::string key = a.substr(2), value;
+            size_t eq = key.find('=');
+            if (eq != std::string::npos)
+            {
+                value = key.substr(eq + 1);
+                key = key.substr(0, eq);
+            }
+            else if (i + 1 < argc)
+            {
+                value = argv[++i];
+            }
+            else
+            {
+                std::cerr << "Missing value for --" << key << std::endl;
+                valid = false;
+                continue;
+            }
+            if (key == "config")
+                load(value);
+            else
+                values[key] = value;
+        }
+        positional.push_back(nullptr);
+    }
+
+    int argc() const { return (int)positional.size() - 1; }
+    char **argv() { return positional.data(); }
+
+    // Each get leaves v untouched when the key is absent.
+    bool get(const char *key, int &v) { return parse(key, [&](const std::string &s, size_t &end)
+                                                     { v = std::stoi(s, &end); }); }
+    bool get(const char *key, double &v) { return parse(key, [&](const std::string &s, size_t &end)
+                                                        { v = std::stod(s, &end); }); }
+    bool get(const char *key, std::string &v) { return parse(key, [&](const std::string &s, size_t &end)
+                                                             { v = s; end = s.size(); }); }
+
+    // Comma-separated list of exactly count values.
+    bool get(const char *key, double *v, int count)
+    {
+        return parse(key, [&](const std::string &s, size_t &end)
+                     {
+                         std::vector<double> parsed;
+                         std::istringstream ss(s);
+                         std::string item;
+                         while (std::getline(ss, item, ','))
+                             parsed.push_back(std::stod(item));
+                         if ((int)parsed.size() != count)
+                             throw std::invalid_argument("count");
+                         for (int i = 0; i < count; i++)
+                             v[i] = parsed[i];
+                         end = s.size(); });
+    }
+
+    // Comma-separated list of any length.
+    bool get(const char *key, std::vector<double> &v)
+    {
+        return parse(key, [&](const std::string &s, size_t &end)
+                     {
+                         std::vector<double> parsed;
+                         std::istringstream ss(s);
+                         std::string item;
+                         while (std::getline(ss, item, ','))
+                             parsed.push_back(std::stod(item));
+                         if (parsed.empty())
+                             throw std::invalid_argument("empty");
+                         v = parsed;
+                         end = s.size(); });
+    }
+
+    // False if anything failed to parse or a key was never asked for, which
+    // is almost always a typo.
+    bool finish()
+    {
+        for (const auto &kv : values)
+        {
+            if (!used.count(kv.first))
+            {
+                std::cerr << "Unknown option --" << kv.first << std::endl;
+                valid = false;
+            }
+        }
+        return valid;
+    }
+
+private:
+    std::vector<char *> positional;
+    std::map<std::string, std::string> values;
+    std::map<std::string, bool> used;
+    bool valid = true;
+
+    void load(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open config " << path << std::endl;
+            valid = false;
+            return;
+        }
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line = line.substr(0, line.find('#'));
+            size_t eq = line.find('=');
+            if (eq == std::string::npos)
+            {
+                if (line.find_first_not_of(" \t\r") != std::string::npos)
+                {
+                    std::cerr << "Bad config line in " << path << ": " << line << std::endl;
+                    valid = false;
+                }
+                continue;
+            }
+            values[trim(line.substr(0, eq))] = trim(line.substr(eq + 1));
+        }
+    }
+
+    static std::string trim(const std::string &s)
+    {
+        size_t b = s.find_first_not_of(" \t\r");
+        size_t e = s.find_last_not_of(" \t\r");
+        return b == std::string::npos ? "" : s.substr(b, e - b + 1);
+    }
+
+    template <typename Parse>
+    bool parse(const char *key, Parse set)
+    {
+        auto it = values.find(key);
+        if (it == values.end())
+            return false;
+        used[key] = true;
+        size_t end = 0;
+        try
+        {
+            set(it->second, end);
+        }
+        catch (const std::exception &)
+        {
+            end = std::string::npos;
+        }
+        if (end != it->second.size())
+        {
+            std::cerr << "Bad value for --" << key << ": " << it->second << std::endl;
+            valid = false;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Grid sizes that get a compile-time specialized copy of the heat and
+// dispersion kernels (constant size, constant parameters); any other size or
+// non-default parameter runs the general path. make GRID_SIZE=... adds one.
+#ifndef GRID_SIZE
+#define GRID_SIZE 4000
+#endif
+
+template <int... Sizes>
+struct SizeList
+{
+};
+
+using FastSizes = SizeList<512, 1000, 1024, 2000, 2048, 4000, GRID_SIZE>;
+
+// Calls run(Fixed<n>(p)) when the parameters are the defaults and n is one of
+// the fast sizes, run(p) otherwise. Fixed<n> copies whatever p holds that is
+// not compiled in, such as tile sizes.
+template <template <int> class Fixed, typename Params, typename Run, int... Sizes>
+int dispatch(const Params &p, Run run, SizeList<Sizes...>)
+{
+    int rc = 0;
+    bool fast = p.defaults() && ((p.n == Sizes && (rc = run(Fixed<Sizes>(p)), true)) || ...);
+    return fast ? rc : run(p);
+}
+
+// Whole-grid element counts and offsets go to MPI as ints, and the
+// dispersion programs count cells in ints, so those need n * n to fit in an
+// int (n <= 46340). The Makefile builds the MPI programs with -DSIM_MPI.
+#ifdef SIM_MPI
+constexpr bool INT_GRID_COUNTS = true;
+#else
+constexpr bool INT_GRID_COUNTS = false;
+#endif
+
+inline bool fits_int_counts(int n)
+{
+    return (long long)n * n <= INT_MAX;
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef SHARED_CONVERGE_H
+#define SHARED_CONVERGE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Early stop of the heat programs once the field stops changing.
+//
+//   build/1/tiled in.csv --steps 100000 --converge 1e-6
+//   mpirun -np 4 build/4/1/async in.csv --converge 1e-4 --converge-norm l2 --converge-every 50
+//
+// Every --converge-every steps (default 10) the sweep also measures how far
+// the step moved the field: the largest change of a cell (--converge-norm
+// max, the default) or the root mean square change (l2, the L2 norm of the
+// change over the unit square). The run stops after the first measured step
+// whose change is below --converge and reports the step it reached on
+// stderr. Steps in between are not measured and cost nothing extra; MPI
+// programs combine the ranks' values with one MPI_Allreduce per measured
+// step, so every rank stops at the same step. Without --converge the
+// programs run exactly --steps steps.
+namespace converge
+{
+    // How far some cells moved in one step.
+    struct Change
+    {
+        double max = 0; // largest change of a cell
+        double sq = 0;  // sum of squared changes
+
+        void add(double d)
+        {
+            max = std::max(max, std::fabs(d));
+            sq += d * d;
+        }
+
+        // Cells [0, count) of a row after and before the step, in LANES
+        // independent lanes so the loop vectorizes.
+        void add(const double *now, const double *before, int count)
+        {
+            constexpr int LANES = 4;
+            double m[LANES] = {}, q[LANES] = {};
+            int j = 0;
+            for (; j + LANES <= count; j += LANES)
+            {
+                for (int l = 0; l < LANES; l++)
+                {
+                    double d = now[j + l] - before[j + l];
+                    m[l] = std::max(m[l], std::fabs(d));
+                    q[l] += d * d;
+                }
+            }
+            for (; j < count; j++)
+                add(now[j] - before[j]);
+            max = std::max(max, std::max(std::max(m[0], m[1]), std::max(m[2], m[3])));
+            sq += (q[0] + q[1]) + (q[2] + q[3]);
+        }
+
+        void merge(const Change &o)
+        {
+            max = std::max(max, o.max);
+            sq += o.sq;
+        }
+    };
+
+    class Check
+    {
+    public:
+        // cells is the size of the whole field; threads the number of
+        // per-thread partials the program fills.
+        Check(double tol, const std::string &norm, int every, double cells, int threads = 1)
+            : tol(tol), l2(norm == "l2"), every(every), cells(cells), parts(threads) {}
+
+        // Whether step t (from 0) is measured.
+        bool due(int t) const { return tol >= 0 && (t + 1) % every == 0; }
+
+        // Thread tid's partial for the step being measured.
+        Change &part(int tid) { return parts[tid]; }
+
+        void reset() { std::fill(parts.begin(), parts.end(), Change()); }
+
+        // The partials merged in thread order.
+        Change gather() const
+        {
+            Change c;
+            for (const auto &p : parts)
+                c.merge(p);
+            return c;
+        }
+
+        // What the ranks combine: the sum of squares for l2, added up
+        // (sums() is true), otherwise the largest change, maximised.
+        double local(const Change &c) const { return l2 ? c.sq : c.max; }
+        bool sums() const { return l2; }
+
+        // Takes the combined value of measured step t; true when the run
+        // has converged and should stop.
+        bool done(int t, double value)
+        {
+            change = l2 ? std::sqrt(value / cells) : value;
+            reached = t + 1;
+            converged = change < tol;
+            return converged;
+        }
+
+        void report(int steps) const
+        {
+            if (tol < 0)
+                return;
+            const char *norm = l2 ? "l2" : "max";
+            if (converged)
+                std::fprintf(stderr, "[converge] steady at step %d of %d: %s change %g < %g\n", reached, steps, norm, change, tol);
+            else if (reached > 0)
+                std::fprintf(stderr, "[converge] not steady after %d steps: %s change %g at step %d\n", steps, norm, change, reached);
+            else
+                std::fprintf(stderr, "[converge] not steady after %d steps: no step measured\n", steps);
+        }
+
+    private:
+        double tol;
+        bool l2;
+        int every;
+        double cells;
+        std::vector<Change> parts;
+        double change = 0;
+        int reached = 0;
+        bool converged = false;
+    };
+}
+
+#endif
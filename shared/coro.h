@@ -0,0 +1,248 @@
+#ifndef SHARED_CORO_H
+#define SHARED_CORO_H
+
+#include <algorithm>
+#include <coroutine>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <vector>
+#include <mpi.h>
+#include "shared/partition.h"
+#include "shared/trace.h"
+
+// Over-decomposed MPI stepping with C++20 coroutines, no external runtime.
+//
+//   mpirun -np 4 build/4/1/coro in.csv --subdomains 8
+//
+// Each rank splits its rows into --subdomains strips and runs one coroutine
+// per strip. A strip posts its halo receives and edge sends, computes the
+// rows that need no halo, and co_awaits the requests; the scheduler then
+// resumes whichever strip is ready, so a rank keeps computing while some of
+// its strips wait on the network, and a slow neighbour only holds up the
+// strips next to it. Completions are picked up with MPI_Testsome between
+// resumptions; only when no strip can run does the rank block, in
+// MPI_Waitsome. Strips on the same rank exchange halos through MPI as well.
+namespace coro
+{
+    // A coroutine started and owned by a Scheduler.
+    struct Task
+    {
+        struct promise_type
+        {
+            Task get_return_object() { return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    class Scheduler
+    {
+    public:
+        ~Scheduler()
+        {
+            for (auto h : tasks)
+                h.destroy();
+        }
+
+        void spawn(Task t)
+        {
+            tasks.push_back(t.handle);
+            ready.push_back(t.handle);
+        }
+
+        // co_await wait(reqs, count) suspends until all count requests
+        // have completed.
+        struct Wait
+        {
+            Scheduler &s;
+            MPI_Request *reqs;
+            int count;
+            int remaining = 0;
+            std::coroutine_handle<> handle{};
+
+            bool await_ready()
+            {
+                int done = 0;
+                MPI_Testall(count, reqs, &done, MPI_STATUSES_IGNORE);
+                return done;
+            }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                handle = h;
+                for (int i = 0; i < count; i++)
+                {
+                    if (reqs[i] == MPI_REQUEST_NULL)
+                        continue;
+                    s.pending.push_back(reqs[i]);
+                    s.waiters.push_back(this);
+                    remaining++;
+                }
+            }
+
+            void await_resume() {}
+        };
+
+        Wait wait(MPI_Request *reqs, int count) { return Wait{*this, reqs, count}; }
+
+        // Runs every task to completion.
+        void run()
+        {
+            size_t finished = 0;
+            while (finished < tasks.size())
+            {
+                if (!ready.empty())
+                {
+                    auto h = ready.front();
+                    ready.pop_front();
+                    h.resume();
+                    finished += h.done();
+                    progress(false);
+                }
+                else if (!pending.empty())
+                {
+                    progress(true);
+                }
+                else
+                {
+                    std::fprintf(stderr, "coro: tasks left with nothing to wait for\n");
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+            }
+        }
+
+    private:
+        std::vector<std::coroutine_handle<>> tasks;
+        std::deque<std::coroutine_handle<>> ready;
+        std::vector<MPI_Request> pending;
+        std::vector<Wait *> waiters;
+        std::vector<int> indices;
+
+        void progress(bool block)
+        {
+            if (pending.empty())
+                return;
+            int n = (int)pending.size();
+            indices.resize(n);
+            int completed = 0;
+            MPI_Testsome(n, pending.data(), &completed, indices.data(), MPI_STATUSES_IGNORE);
+            if (completed == 0 && block)
+            {
+                trace::Span span("MPI_Waitsome", "wait");
+                MPI_Waitsome(n, pending.data(), &completed, indices.data(), MPI_STATUSES_IGNORE);
+            }
+            if (completed <= 0)
+                return;
+            for (int k = 0; k < completed; k++)
+            {
+                Wait *w = waiters[indices[k]];
+                if (--w->remaining == 0)
+                    ready.push_back(w->handle);
+            }
+            // Completed requests are now MPI_REQUEST_NULL.
+            size_t kept = 0;
+            for (size_t i = 0; i < pending.size(); i++)
+            {
+                if (pending[i] == MPI_REQUEST_NULL)
+                    continue;
+                pending[kept] = pending[i];
+                waiters[kept++] = waiters[i];
+            }
+            pending.resize(kept);
+            waiters.resize(kept);
+        }
+    };
+
+    // Rows [first, first + rows) of an n_rows x cols field, stored with one
+    // halo row above and below and one boundary column on each side, so
+    // cell (i, j) of the strip is at (i + 1) * (cols + 2) + j + 1. Strip g of
+    // count receives its halos from strips g - 1 and g + 1.
+    struct Strip
+    {
+        int g;
+        int count;
+        int first;
+        int rows;
+        int cols;
+        int up_rank;
+        int down_rank;
+        std::vector<double> cur;
+        std::vector<double> next;
+
+        Strip(int g, int count, int first, int rows, int cols, int up_rank, int down_rank, double boundary)
+            : g(g), count(count), first(first), rows(rows), cols(cols), up_rank(up_rank), down_rank(down_rank),
+              cur((size_t)(rows + 2) * (cols + 2), boundary), next(cur) {}
+
+        double *row(int i) { return cur.data() + (size_t)(i + 1) * (cols + 2) + 1; }
+    };
+
+    // The strips of this rank when each of size ranks splits its block rows
+    // (shared/partition.h) into per_rank strips; per_rank is capped so every
+    // strip has a row.
+    inline std::vector<Strip> split(int n_rows, int cols, int size, int rank, int per_rank, double boundary)
+    {
+        per_rank = std::max(1, std::min(per_rank, n_rows / size));
+        int count = size * per_rank;
+        int rows = block_rows(n_rows, size, rank);
+        int base = block_start(n_rows, size, rank);
+        std::vector<Strip> strips;
+        for (int k = 0; k < per_rank; k++)
+        {
+            int g = rank * per_rank + k;
+            int up = g > 0 ? (g - 1) / per_rank : MPI_PROC_NULL;
+            int down = g + 1 < count ? (g + 1) / per_rank : MPI_PROC_NULL;
+            strips.emplace_back(g, count, base + block_start(rows, per_rank, k), block_rows(rows, per_rank, k), cols, up,
+                                down, boundary);
+        }
+        return strips;
+    }
+
+    // Advances strip s steps times. row(cur, next, i) computes row i of next
+    // (strip rows from 1, row stride cols + 2) from cur and returns a count;
+    // done(t, count) gets the strip's total for step t.
+    template <typename Row, typename Done>
+    Task advance(Scheduler &sched, Strip &s, int steps, Row row, Done done)
+    {
+        const int W = s.cols + 2;
+        for (int t = 0; t < steps; t++)
+        {
+            double *c = s.cur.data();
+            MPI_Request req[4];
+            int n = 0;
+            // Tag 2g: the row from above strip g; 2g + 1: from below.
+            if (s.g > 0)
+            {
+                MPI_Irecv(c + 1, s.cols, MPI_DOUBLE, s.up_rank, 2 * s.g, MPI_COMM_WORLD, &req[n++]);
+                MPI_Isend(c + W + 1, s.cols, MPI_DOUBLE, s.up_rank, 2 * (s.g - 1) + 1, MPI_COMM_WORLD, &req[n++]);
+            }
+            if (s.g + 1 < s.count)
+            {
+                MPI_Irecv(c + (size_t)(s.rows + 1) * W + 1, s.cols, MPI_DOUBLE, s.down_rank, 2 * s.g + 1, MPI_COMM_WORLD, &req[n++]);
+                MPI_Isend(c + (size_t)s.rows * W + 1, s.cols, MPI_DOUBLE, s.down_rank, 2 * (s.g + 1), MPI_COMM_WORLD, &req[n++]);
+            }
+
+            long long count = 0;
+            {
+                trace::Span span("interior", "compute", t);
+                for (int i = 2; i < s.rows; i++)
+                    count += row(c, s.next.data(), i);
+            }
+            co_await sched.wait(req, n);
+            {
+                trace::Span span("edge rows", "compute", t);
+                count += row(c, s.next.data(), 1);
+                if (s.rows > 1)
+                    count += row(c, s.next.data(), s.rows);
+            }
+            std::swap(s.cur, s.next);
+            done(t, count);
+        }
+    }
+}
+
+#endif
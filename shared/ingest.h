@@ -0,0 +1,149 @@
+#ifndef SHARED_INGEST_H
+#define SHARED_INGEST_H
+
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Pipelined input: the first step starts while the CSV is still being read.
+//
+//   SIM_PIPELINE=1 build/1/sequential in.csv
+//   SIM_PIPELINE=1 mpirun -np 4 build/4/1/async in.csv
+//
+// A reader thread parses the input BAND rows at a time and publishes how many
+// rows are in (the watermark). The first step computes row i as soon as rows
+// up to i + 1 are in, so parsing and the first step overlap. In the MPI
+// programs rank 0 parses and sends every band to the rank that owns it as
+// soon as the band is complete (shared/ingest_mpi.h), instead of scattering
+// the whole grid after the whole file, and the other ranks start on their
+// first rows while later ones are still being parsed. Results are those of a
+// normal run bit for bit. Not used when SIM_CHECKPOINT is set, since a
+// resumed run replaces the input. Programs that do not use it read the
+// whole file first.
+namespace ingest
+{
+    constexpr int BAND = 16;
+
+    inline bool enabled()
+    {
+        const char *v = std::getenv("SIM_PIPELINE");
+        return v != nullptr && *v != '\0' && std::strcmp(v, "0") != 0;
+    }
+
+    // Parses rows x cols comma-separated values on a thread into row(i),
+    // row i of the field.
+    class Reader
+    {
+    public:
+        Reader() = default;
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        ~Reader() { finish(); }
+
+        template <typename RowFn>
+        void start(const std::string &path, int rows, int cols, RowFn row)
+        {
+            on = true;
+            total = rows;
+            worker = std::thread([this, path, rows, cols, row]()
+                                 {
+                std::ifstream file(path);
+                if (!file.is_open())
+                {
+                    std::cerr << "Failed to open file " << path << std::endl;
+                    publish(0, true);
+                    return;
+                }
+                std::string line, token;
+                for (int i = 0; i < rows; i++)
+                {
+                    bool ok = (bool)std::getline(file, line);
+                    double *dst = row(i);
+                    std::istringstream ss(line);
+                    for (int j = 0; ok && j < cols; j++)
+                    {
+                        ok = (bool)std::getline(ss, token, ',');
+                        try
+                        {
+                            if (ok)
+                                dst[j] = std::stod(token);
+                        }
+                        catch (const std::exception &)
+                        {
+                            ok = false;
+                        }
+                    }
+                    if (!ok)
+                    {
+                        std::cerr << "Bad input at row " << i + 1 << " of " << path << std::endl;
+                        publish(i, true);
+                        return;
+                    }
+                    if ((i + 1) % BAND == 0 || i + 1 == rows)
+                        publish(i + 1, false);
+                } });
+        }
+
+        // Whether a read is in progress.
+        bool active() const { return on; }
+
+        // Rows in so far.
+        int ready()
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            return done;
+        }
+
+        // Blocks until the first count rows are in; false if the input
+        // ended or failed before them.
+        bool wait(int count)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&]
+                    { return done >= count || failed; });
+            return done >= count;
+        }
+
+        // Waits for the whole input; false if it failed. Nothing to do when
+        // no read was started.
+        bool finish()
+        {
+            if (!on)
+                return ok;
+            ok = wait(total);
+            worker.join();
+            on = false;
+            return ok;
+        }
+
+    private:
+        std::thread worker;
+        std::mutex mtx;
+        std::condition_variable cv;
+        int done = 0;
+        int total = 0;
+        bool failed = false;
+        bool on = false;
+        bool ok = true;
+
+        void publish(int rows, bool fail)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                done = rows;
+                failed = fail;
+            }
+            cv.notify_all();
+        }
+    };
+}
+
+#endif
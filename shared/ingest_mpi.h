@@ -0,0 +1,205 @@
+#ifndef SHARED_INGEST_MPI_H
+#define SHARED_INGEST_MPI_H
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <mpi.h>
+#include "shared/ingest.h"
+#include "shared/partition.h"
+#include "shared/trace.h"
+
+// Pipelined input of the MPI programs (see shared/ingest.h). Rank 0 parses
+// the n_rows x cols input with a Reader and sends each band of up to BAND
+// rows to the rank that owns it (block rows, shared/partition.h) as soon as
+// the band is in; the other ranks receive their bands in order. Only the
+// calling thread makes MPI calls, and rank 0 sends whatever has been parsed
+// whenever it waits, so it never holds up a rank that could be computing. A
+// bad input aborts the job, since the other ranks would wait for it forever.
+namespace ingest
+{
+    constexpr int TAG = 1;
+
+    class Scatter
+    {
+    public:
+        Scatter() = default;
+        Scatter(const Scatter &) = delete;
+        Scatter &operator=(const Scatter &) = delete;
+
+        // grid holds the whole input on rank 0; row(i) is where local row
+        // i goes on this rank.
+        template <typename RowFn>
+        void start(const char *path, double *grid, int n_rows, int cols, int rank, int size, RowFn row)
+        {
+            on = true;
+            this->grid = grid;
+            this->cols = cols;
+            this->rank = rank;
+            this->size = size;
+            this->row = row;
+            rows = block_rows(n_rows, size, rank);
+            for (int r = 0; r < size; r++)
+            {
+                int first = block_start(n_rows, size, r), count = block_rows(n_rows, size, r);
+                for (int i = 0; i < count; i += BAND)
+                    bands.push_back({r, first + i, std::min(BAND, count - i)});
+            }
+            if (rank == 0)
+            {
+                sends.reserve(bands.size());
+                reader.start(path, n_rows, cols, [grid, cols](int i)
+                             { return grid + (size_t)i * cols; });
+                return;
+            }
+            stage.resize((size_t)rows * cols);
+            for (const Band &b : bands)
+            {
+                if (b.rank != rank)
+                    continue;
+                recvs.emplace_back();
+                int at = (int)(recvs.size() - 1) * BAND;
+                MPI_Irecv(stage.data() + (size_t)at * cols, b.count * cols, MPI_DOUBLE, 0, TAG, MPI_COMM_WORLD, &recvs.back());
+            }
+        }
+
+        bool active() const { return on; }
+
+        // Blocks until local rows [0, count) are in place.
+        void wait(int count)
+        {
+            if (placed >= count)
+                return;
+            trace::Span span("ingest", "wait", count);
+            if (rank == 0)
+            {
+                for (pump(); placed < count; pump())
+                    more();
+                return;
+            }
+            for (size_t k = placed / BAND; placed < count; k++)
+            {
+                MPI_Wait(&recvs[k], MPI_STATUS_IGNORE);
+                int n = std::min(BAND, rows - placed);
+                for (int i = placed; i < placed + n; i++)
+                    std::copy(stage.data() + (size_t)i * cols, stage.data() + (size_t)(i + 1) * cols, row(i));
+                placed += n;
+            }
+        }
+
+        // The first step's halo exchange for a slab stored with a halo row
+        // above and below, row stride w. Call before computing slab row i
+        // (1 to rows): it makes sure the rows i reads are in, sends the edge
+        // rows to the neighbours as soon as they are in and waits for a
+        // halo row only before the row that reads it.
+        void before_row(double *slab, long w, int i)
+        {
+            if (i == 1)
+            {
+                if (rank != 0)
+                    MPI_Irecv(slab + 1, cols, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &halo[0]);
+                if (rank != size - 1)
+                    MPI_Irecv(slab + (rows + 1) * w + 1, cols, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &halo[1]);
+            }
+            wait(std::min(i + 1, rows));
+            if (i == 1 && rank != 0)
+                MPI_Isend(slab + w + 1, cols, MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, &edge[0]);
+            if (placed == rows && edge[1] == MPI_REQUEST_NULL && rank != size - 1)
+                MPI_Isend(slab + rows * w + 1, cols, MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD, &edge[1]);
+            if (i == 1)
+                complete(halo[0]);
+            if (i == rows)
+                complete(halo[1]);
+        }
+
+        // Every local row in place and every send done; on rank 0 after the
+        // whole input is parsed and sent.
+        void finish()
+        {
+            if (!on)
+                return;
+            wait(rows);
+            if (rank == 0)
+            {
+                for (pump(); next < bands.size(); pump())
+                    more();
+                reader.finish();
+                MPI_Waitall((int)sends.size(), sends.data(), MPI_STATUSES_IGNORE);
+            }
+            MPI_Waitall(2, edge, MPI_STATUSES_IGNORE);
+            on = false;
+        }
+
+    private:
+        struct Band
+        {
+            int rank, first, count;
+        };
+
+        bool on = false;
+        double *grid = nullptr;
+        int cols = 0, rank = 0, size = 1, rows = 0;
+        int placed = 0;
+        std::function<double *(int)> row;
+        std::vector<Band> bands;
+        Reader reader;                   // rank 0
+        size_t next = 0;                 // rank 0: first band not yet sent
+        std::vector<MPI_Request> sends;  // rank 0
+        std::vector<double> stage;       // other ranks: the bands as they arrive
+        std::vector<MPI_Request> recvs;  // other ranks
+        MPI_Request halo[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+        MPI_Request edge[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+
+        // Rank 0: sends, or places, every band that has been parsed.
+        void pump()
+        {
+            int ready = reader.ready();
+            for (; next < bands.size() && bands[next].first + bands[next].count <= ready; next++)
+            {
+                const Band &b = bands[next];
+                if (b.rank == 0)
+                {
+                    for (int i = b.first; i < b.first + b.count; i++)
+                        std::copy(grid + (size_t)i * cols, grid + (size_t)(i + 1) * cols, row(i));
+                    placed += b.count;
+                    continue;
+                }
+                sends.emplace_back();
+                MPI_Isend(grid + (size_t)b.first * cols, b.count * cols, MPI_DOUBLE, b.rank, TAG, MPI_COMM_WORLD, &sends.back());
+            }
+        }
+
+        // Rank 0: blocks until the next band is parsed.
+        void more()
+        {
+            const Band &b = bands[next];
+            if (!reader.wait(b.first + b.count))
+                MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        // Waits for req; rank 0 keeps sending bands meanwhile.
+        void complete(MPI_Request &req)
+        {
+            trace::Span span("halo", "wait");
+            if (rank != 0)
+            {
+                MPI_Wait(&req, MPI_STATUS_IGNORE);
+                return;
+            }
+            for (;;)
+            {
+                int done = 0;
+                MPI_Test(&req, &done, MPI_STATUS_IGNORE);
+                pump();
+                if (done)
+                    return;
+                if (next == bands.size())
+                    break;
+                more();
+            }
+            MPI_Wait(&req, MPI_STATUS_IGNORE);
+        }
+    };
+}
+
+#endif
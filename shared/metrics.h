@@ -0,0 +1,211 @@
+#ifndef SHARED_METRICS_H
+#define SHARED_METRICS_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Per-step statistics of the dispersion field, computed in the stencil pass
+// as the new cells are written.
+//
+//   SIM_METRICS=plume.csv build/2/sequential in.csv
+//   SIM_METRICS_SET          columns to report, any of mass,peak,area
+//                            (default all three)
+//   SIM_METRICS_THRESHOLDS   concentrations for the area columns
+//                            (default 1,10,100, at most MAX_THRESHOLDS)
+//
+// The file gets a header line and one line per step: the step, the total
+// mass (concentration times cell area), the peak concentration and its cell
+// (row and column of the full grid, the first in row-major order on ties)
+// and the area above each threshold. Programs keep one Partial per thread,
+// tile or strip and merge them in a fixed order once per step, so a run's
+// numbers do not depend on scheduling; MPI programs merge the ranks with one
+// reduction per step (shared/metrics_mpi.h), which also carries the step's
+// uncontaminated count. Peak and areas are exact and
+// the same in every program; mass is summed in a different order for each
+// decomposition and agrees to rounding. With SIM_METRICS unset every call is
+// a branch on a bool.
+namespace metrics
+{
+    constexpr int MAX_THRESHOLDS = 8;
+
+    // Statistics of some of the cells. Plain doubles, so MPI can move it as
+    // a contiguous block; cell counts stay exact up to 2^53. uncontaminated
+    // is the stencil's zero count, set by the programs whether or not
+    // SIM_METRICS is set, so the MPI programs reduce it with the rest.
+    struct Partial
+    {
+        double uncontaminated = 0;
+        double mass = 0;
+        double peak = -1;
+        double where = -1; // row-major cell index of peak
+        double above[MAX_THRESHOLDS] = {};
+
+        void merge(const Partial &o)
+        {
+            uncontaminated += o.uncontaminated;
+            mass += o.mass;
+            if (o.peak > peak || (o.peak == peak && o.where < where))
+            {
+                peak = o.peak;
+                where = o.where;
+            }
+            for (int k = 0; k < MAX_THRESHOLDS; k++)
+                above[k] += o.above[k];
+        }
+    };
+
+    class Set
+    {
+    public:
+        // A field with cols columns of cell_area each. Only the writer opens
+        // the file; the other ranks just accumulate.
+        Set(int cols, double cell_area, bool writer = true) : cols(cols), cell_area(cell_area)
+        {
+            const char *path = std::getenv("SIM_METRICS");
+            if (path == nullptr || *path == '\0')
+                return;
+            on = true;
+
+            const char *names = std::getenv("SIM_METRICS_SET");
+            if (names != nullptr)
+            {
+                show_mass = show_peak = show_area = false;
+                std::string list = names;
+                size_t at = 0;
+                while (at <= list.size())
+                {
+                    size_t end = std::min(list.find(',', at), list.size());
+                    std::string name = list.substr(at, end - at);
+                    if (name == "mass")
+                        show_mass = true;
+                    else if (name == "peak")
+                        show_peak = true;
+                    else if (name == "area")
+                        show_area = true;
+                    else if (!name.empty() && writer)
+                        std::fprintf(stderr, "[metrics] ignoring unknown metric %s\n", name.c_str());
+                    at = end + 1;
+                }
+            }
+
+            const char *levels = std::getenv("SIM_METRICS_THRESHOLDS");
+            if (levels == nullptr)
+                levels = "1,10,100";
+            const char *p = levels;
+            char *end = nullptr;
+            while (*p != '\0' && n_thresholds < MAX_THRESHOLDS)
+            {
+                double v = std::strtod(p, &end);
+                if (end == p)
+                    break;
+                threshold[n_thresholds++] = v;
+                p = *end == ',' ? end + 1 : end;
+            }
+            if (*p != '\0' && writer)
+                std::fprintf(stderr, "[metrics] SIM_METRICS_THRESHOLDS=%s: using the first %d values\n", levels, n_thresholds);
+            if (!show_area)
+                n_thresholds = 0;
+
+            if (!writer)
+                return;
+            file = std::fopen(path, "w");
+            if (file == nullptr)
+            {
+                std::fprintf(stderr, "Failed to open metrics %s\n", path);
+                return;
+            }
+            std::fprintf(file, "step");
+            if (show_mass)
+                std::fprintf(file, ",mass");
+            if (show_peak)
+                std::fprintf(file, ",peak,peak_i,peak_j");
+            for (int k = 0; k < n_thresholds; k++)
+                std::fprintf(file, ",area_above_%g", threshold[k]);
+            std::fprintf(file, "\n");
+        }
+
+        ~Set()
+        {
+            if (file != nullptr)
+                std::fclose(file);
+        }
+
+        Set(const Set &) = delete;
+        Set &operator=(const Set &) = delete;
+
+        // Adds cells (i, j0) .. (i, j0 + count - 1) of the full grid, held
+        // in v, to p. Called on a row just written, while it is still in
+        // cache, so the stencil loop itself is unchanged. The row is summed
+        // in LANES independent lanes so the loop vectorizes.
+        void add(Partial &p, const double *v, int count, int i, int j0) const
+        {
+            if (!on)
+                return;
+            constexpr int LANES = 4;
+            double mass[LANES] = {}, top[LANES] = {-1, -1, -1, -1};
+            int j = 0;
+            for (; j + LANES <= count; j += LANES)
+            {
+                for (int l = 0; l < LANES; l++)
+                {
+                    mass[l] += v[j + l];
+                    top[l] = std::max(top[l], v[j + l]);
+                }
+            }
+            for (; j < count; j++)
+            {
+                mass[0] += v[j];
+                top[0] = std::max(top[0], v[j]);
+            }
+            p.mass += (mass[0] + mass[1]) + (mass[2] + mass[3]);
+            double peak = std::max(std::max(top[0], top[1]), std::max(top[2], top[3]));
+            if (peak > p.peak)
+            {
+                p.peak = peak;
+                p.where = (double)i * cols + j0 + (std::find(v, v + count, peak) - v);
+            }
+            for (int k = 0; k < n_thresholds; k++)
+            {
+                const double level = threshold[k];
+                int above = 0;
+                for (int j = 0; j < count; j++)
+                    above += v[j] > level;
+                p.above[k] += above;
+            }
+        }
+
+        // Writes the line of step from the merged statistics of all cells.
+        void write(int step, const Partial &p)
+        {
+            if (file == nullptr)
+                return;
+            std::fprintf(file, "%d", step);
+            if (show_mass)
+                std::fprintf(file, ",%.17g", p.mass * cell_area);
+            if (show_peak)
+            {
+                long long cell = (long long)p.where;
+                std::fprintf(file, ",%.17g,%lld,%lld", p.peak, cell / cols, cell % cols);
+            }
+            for (int k = 0; k < n_thresholds; k++)
+                std::fprintf(file, ",%.17g", p.above[k] * cell_area);
+            std::fprintf(file, "\n");
+        }
+
+        bool on = false;
+
+    private:
+        int cols;
+        double cell_area;
+        bool show_mass = true;
+        bool show_peak = true;
+        bool show_area = true;
+        int n_thresholds = 0;
+        double threshold[MAX_THRESHOLDS] = {};
+        std::FILE *file = nullptr;
+    };
+}
+
+#endif
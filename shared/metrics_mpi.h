@@ -0,0 +1,120 @@
+#ifndef SHARED_METRICS_MPI_H
+#define SHARED_METRICS_MPI_H
+
+#include <vector>
+#include <mpi.h>
+#include "shared/metrics.h"
+#include "shared/trace.h"
+
+// Reduction of metrics::Partial across ranks (see shared/metrics.h). The
+// operation is registered as non-commutative, so MPI merges the ranks in
+// rank order and a run gives the same numbers every time.
+namespace metrics
+{
+    inline void merge_op(void *in, void *inout, int *len, MPI_Datatype *)
+    {
+        const Partial *a = (const Partial *)in;
+        Partial *b = (Partial *)inout;
+        for (int k = 0; k < *len; k++)
+        {
+            // inout holds the higher ranks; keep rank order in the sum.
+            Partial merged = a[k];
+            merged.merge(b[k]);
+            b[k] = merged;
+        }
+    }
+
+    // Sums each step's Partial onto rank 0 with one MPI_Ireduce, completed
+    // at the next post() so the step loop never waits for rank 0. Rank 0
+    // writes the metrics line and, given counts, stores the step's summed
+    // uncontaminated count in counts[step - 1], so the count needs no
+    // reduction of its own. finish() completes the last step and must run
+    // before MPI_Finalize.
+    class Reducer
+    {
+    public:
+        Reducer(Set &set, int rank, int *counts = nullptr)
+            : set(set), rank(rank), counts(counts), on(set.on || counts != nullptr)
+        {
+            if (!on)
+                return;
+            MPI_Type_contiguous(sizeof(Partial) / sizeof(double), MPI_DOUBLE, &type);
+            MPI_Type_commit(&type);
+            MPI_Op_create(merge_op, 0, &op);
+        }
+
+        void post(int step, const Partial &p)
+        {
+            if (!on)
+                return;
+            complete(step);
+            mine = p;
+            pending = step;
+            MPI_Ireduce(&mine, &total, 1, type, op, 0, MPI_COMM_WORLD, &req);
+        }
+
+        // Completes the last post(), so counts holds every step posted.
+        void wait()
+        {
+            complete(pending);
+        }
+
+        // Reduces all of steps at once, for programs that only have them
+        // after the loop; step k of steps is written as first + k.
+        void reduce_all(int first, const std::vector<Partial> &steps)
+        {
+            if (!on)
+                return;
+            std::vector<Partial> totals(rank == 0 ? steps.size() : 0);
+            {
+                trace::Span span("MPI_Reduce", "comm");
+                MPI_Reduce(steps.data(), totals.data(), (int)steps.size(), type, op, 0, MPI_COMM_WORLD);
+            }
+            for (size_t k = 0; k < totals.size(); k++)
+            {
+                set.write(first + (int)k, totals[k]);
+                if (counts != nullptr)
+                    counts[first + k - 1] = (int)totals[k].uncontaminated;
+            }
+        }
+
+        void finish()
+        {
+            if (!on)
+                return;
+            complete(-1);
+            MPI_Op_free(&op);
+            MPI_Type_free(&type);
+            set.on = false;
+            on = false;
+        }
+
+    private:
+        Set &set;
+        int rank;
+        int *counts;
+        bool on;
+        MPI_Datatype type = MPI_DATATYPE_NULL;
+        MPI_Op op = MPI_OP_NULL;
+        MPI_Request req = MPI_REQUEST_NULL;
+        Partial mine, total;
+        int pending = -1;
+
+        void complete(int step)
+        {
+            if (req == MPI_REQUEST_NULL)
+                return;
+            {
+                trace::Span span("MPI_Wait", "wait", step);
+                MPI_Wait(&req, MPI_STATUS_IGNORE);
+            }
+            if (rank != 0)
+                return;
+            set.write(pending, total);
+            if (counts != nullptr)
+                counts[pending - 1] = (int)total.uncontaminated;
+        }
+    };
+}
+
+#endif
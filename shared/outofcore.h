@@ -0,0 +1,352 @@
+#ifndef SHARED_OUTOFCORE_H
+#define SHARED_OUTOFCORE_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shared/trace.h"
+
+// Out-of-core time stepping of an n x n three-row stencil, for grids larger
+// than memory.
+//
+//   build/1/outofcore in.csv --n 40000 --steps 100 --band 64 --fuse 8
+//
+// The field lives in a file of n rows of n doubles, the SIM_OUTPUT format:
+// SIM_OUTPUT itself when set, otherwise a temporary file in TMPDIR that is
+// removed at exit. A pass streams the file through memory in bands of rows
+// and advances it up to fuse steps: level l keeps the rows of step t + l
+// computed so far in a ring of band + fuse + 2 rows, and a row of level l is
+// computed as soon as level l - 1 has the rows above and below it. A pass
+// reads and writes every row once however many steps it does, and no cell is
+// computed twice. One I/O thread reads the next band while the current one
+// is computed and writes finished rows behind it; a row is only written once
+// every level is past it, so the pass updates the file in place.
+//
+// The first pass reads the input: CSV, or raw doubles when the name ends in
+// .bin, so a run can continue from another run's SIM_OUTPUT (or its own,
+// in place). Memory is about (fuse + 4) * (band + fuse) rows.
+namespace ooc
+{
+    // Fills rows [first, first + rows) into dst, n doubles per row. Called
+    // for consecutive bands from row 0.
+    using Reader = std::function<bool(int first, int rows, double *dst)>;
+
+    inline bool transfer(bool write, int fd, double *buf, size_t bytes, off_t offset)
+    {
+        char *p = (char *)buf;
+        while (bytes > 0)
+        {
+            ssize_t done = write ? pwrite(fd, p, bytes, offset) : pread(fd, p, bytes, offset);
+            if (done <= 0)
+                return false;
+            p += done;
+            bytes -= done;
+            offset += done;
+        }
+        return true;
+    }
+
+    inline Reader file_reader(int fd, int n)
+    {
+        return [fd, n](int first, int rows, double *dst)
+        {
+            return transfer(false, fd, dst, (size_t)rows * n * sizeof(double), (off_t)first * n * sizeof(double));
+        };
+    }
+
+    inline Reader csv_reader(const std::string &path, int n)
+    {
+        auto file = std::make_shared<std::ifstream>(path);
+        return [file, n](int, int rows, double *dst)
+        {
+            std::string line, token;
+            for (int i = 0; i < rows; i++)
+            {
+                if (!std::getline(*file, line))
+                    return false;
+                std::istringstream ss(line);
+                for (int j = 0; j < n; j++)
+                {
+                    if (!std::getline(ss, token, ','))
+                        return false;
+                    try
+                    {
+                        dst[(size_t)i * n + j] = std::stod(token);
+                    }
+                    catch (const std::exception &)
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        };
+    }
+
+    // The file holding the field between and during passes.
+    class Store
+    {
+    public:
+        explicit Store(int n) : bytes((off_t)n * n * sizeof(double))
+        {
+            const char *out = std::getenv("SIM_OUTPUT");
+            if (out != nullptr && *out != '\0')
+            {
+                path = out;
+            }
+            else
+            {
+                path = (std::filesystem::temp_directory_path() / ("sim_ooc." + std::to_string(getpid()) + ".bin")).string();
+                temporary = true;
+            }
+            fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (fd < 0)
+                std::fprintf(stderr, "Failed to open store %s\n", path.c_str());
+        }
+
+        ~Store()
+        {
+            if (fd >= 0)
+                close(fd);
+            if (temporary)
+                std::remove(path.c_str());
+        }
+
+        // Reader for the input: this file when input is the store, any other
+        // .bin as raw doubles, CSV otherwise. Sizes the store.
+        Reader input(const std::string &input_path, int n)
+        {
+            std::error_code ec;
+            bool raw = input_path.size() > 4 && input_path.compare(input_path.size() - 4, 4, ".bin") == 0;
+            if (raw && std::filesystem::equivalent(input_path, path, ec))
+                return file_reader(fd, n);
+            if (ftruncate(fd, bytes) != 0)
+                return nullptr;
+            if (!raw)
+                return std::ifstream(input_path).is_open() ? csv_reader(input_path, n) : nullptr;
+            int in = open(input_path.c_str(), O_RDONLY);
+            if (in < 0)
+                return nullptr;
+            owned.push_back(std::shared_ptr<int>(new int(in), [](int *f)
+                                                 { close(*f); delete f; }));
+            return file_reader(in, n);
+        }
+
+        int fd = -1;
+        std::string path;
+
+    private:
+        off_t bytes;
+        bool temporary = false;
+        std::vector<std::shared_ptr<int>> owned;
+    };
+
+    // Runs reads and writes on one thread in submission order.
+    class Io
+    {
+    public:
+        Io() : worker(&Io::run, this) {}
+
+        ~Io()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                done = true;
+            }
+            cv.notify_all();
+            worker.join();
+        }
+
+        size_t submit(std::function<bool()> job)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            jobs.push_back(std::move(job));
+            cv.notify_all();
+            return ++submitted;
+        }
+
+        // Waits for job ticket and everything before it; false once any job
+        // has failed.
+        bool wait(size_t ticket, double &waited)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&]
+                    { return finished >= ticket; });
+            waited += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return !failed;
+        }
+
+        bool drain(double &waited) { return wait(submitted, waited); }
+
+    private:
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<std::function<bool()>> jobs;
+        size_t submitted = 0;
+        size_t finished = 0;
+        bool failed = false;
+        bool done = false;
+        std::thread worker;
+
+        void run()
+        {
+            trace::name_thread("out-of-core io");
+            std::unique_lock<std::mutex> lock(mtx);
+            for (;;)
+            {
+                cv.wait(lock, [&]
+                        { return done || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                auto job = std::move(jobs.front());
+                jobs.pop_front();
+                lock.unlock();
+                bool ok;
+                {
+                    trace::Span span("band io", "io");
+                    ok = job();
+                }
+                lock.lock();
+                finished++;
+                failed |= !ok;
+                cv.notify_all();
+            }
+        }
+    };
+
+    // Advances the field from read through steps steps into store, fuse at a
+    // time. row(up, mid, down, out) computes one row from the rows above, at
+    // and below it; each points at column 0 of n + 2 columns whose first and
+    // last hold boundary, and row returns a per-row count (e.g. of zero
+    // cells). done(t, count) gets each step's total, in order, at the end of
+    // the pass that computed it. Rows outside the grid hold boundary.
+    template <typename Row, typename Done>
+    bool run(const Reader &read, Store &store, int n, int steps, int band, int fuse, double boundary, Row row, Done done)
+    {
+        const int W = n + 2;
+        // In the last band level l computes up to band + l rows.
+        const int C = band + fuse + 2;
+        const int bands = (n + band - 1) / band;
+        const size_t out_rows = (size_t)band + fuse;
+        std::vector<double> edge(W, boundary);
+        std::vector<std::vector<double>> ring(std::min(fuse, steps), std::vector<double>((size_t)C * W, boundary));
+        std::vector<double> in[2], out[2];
+        for (int b = 0; b < 2; b++)
+        {
+            in[b].resize((size_t)band * n);
+            // One leading double so that row r can be computed in place at
+            // column 1 of out_row(r).
+            out[b].resize(out_rows * n + 2);
+        }
+        Reader from_store = file_reader(store.fd, n);
+        Io io;
+        double read_wait = 0, write_wait = 0;
+        int passes = 0;
+
+        for (int t = 0; t < steps || passes == 0; passes++)
+        {
+            const int k = std::min(fuse, steps - t);
+            const Reader &src = passes == 0 ? read : from_store;
+            // Rows [0, h[l]) of level l are done; level k is written out.
+            std::vector<int> h(k + 1, 0);
+            std::vector<long long> counts(k + 1, 0);
+            auto at = [&](int l, int r) -> double *
+            { return r < 0 || r >= n ? edge.data() : ring[l].data() + (size_t)(r % C) * W; };
+            auto fetch = [&](int b)
+            {
+                int first = b * band;
+                int rows = std::min(band, n - first);
+                double *dst = in[b % 2].data();
+                return io.submit([&src, first, rows, dst]
+                                 { return src(first, rows, dst); });
+            };
+            size_t reading = fetch(0);
+            size_t writing[2] = {0, 0};
+            int written = 0;
+            bool ok = true;
+
+            for (int b = 0; b < bands && ok; b++)
+            {
+                if (!io.wait(reading, read_wait))
+                {
+                    ok = false;
+                    break;
+                }
+                const int first = b * band;
+                const int rows = std::min(band, n - first);
+                const double *src_rows = in[b % 2].data();
+                h[0] = first + rows;
+                double *band_out = out[b % 2].data();
+                ok = io.wait(writing[b % 2], write_wait);
+                if (k == 0)
+                {
+                    std::memcpy(band_out + 1, src_rows, (size_t)rows * n * sizeof(double));
+                }
+                else
+                {
+                    for (int i = 0; i < rows; i++)
+                        std::memcpy(at(0, first + i) + 1, src_rows + (size_t)i * n, n * sizeof(double));
+                }
+                if (b + 1 < bands)
+                    reading = fetch(b + 1);
+
+                for (int l = 1; l <= k; l++)
+                {
+                    int lo = h[l];
+                    int hi = h[l - 1] == n ? n : std::max(lo, h[l - 1] - 1);
+                    long long count = 0;
+#pragma omp parallel for schedule(static) reduction(+ : count)
+                    for (int r = lo; r < hi; r++)
+                    {
+                        double *dst = l == k ? band_out + (size_t)(r - written) * n : at(l, r);
+                        count += row(at(l - 1, r - 1), at(l - 1, r), at(l - 1, r + 1), dst);
+                    }
+                    counts[l] += count;
+                    h[l] = hi;
+                }
+
+                if (h[k] > written)
+                {
+                    double *src_buf = band_out + 1;
+                    size_t bytes = (size_t)(h[k] - written) * n * sizeof(double);
+                    off_t offset = (off_t)written * n * sizeof(double);
+                    int fd = store.fd;
+                    writing[b % 2] = io.submit([fd, src_buf, bytes, offset]
+                                               { return transfer(true, fd, src_buf, bytes, offset); });
+                    written = h[k];
+                }
+            }
+            if (!io.drain(write_wait) || !ok)
+            {
+                std::fprintf(stderr, "Out-of-core pass %d failed to read or write %s\n", passes, store.path.c_str());
+                return false;
+            }
+            for (int l = 1; l <= k; l++)
+                done(t + l, counts[l]);
+            t += k;
+        }
+
+        double rows_in_memory = (double)ring.size() * C + 2.0 * band + 2.0 * out_rows;
+        std::fprintf(stderr, "[ooc] %d passes of up to %d steps, %.0f MB in memory, waited %.3f s for reads and %.3f s for writes\n",
+                     passes, std::min(fuse, steps), rows_in_memory * W * sizeof(double) / 1e6, read_wait, write_wait);
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SHARED_OUTPUT_H
+#define SHARED_OUTPUT_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+// Writes the final field as raw row-major doubles to the file named by the
+// SIM_OUTPUT environment variable and does nothing when it is unset. The
+// benchmark harness (bench/bench.py) uses it to compare every variant with
+// the sequential reference. row(i) returns a pointer to the first cell of
+// row i, so padded and unpadded layouts can both be written.
+template <typename RowFn>
+inline void write_output(int rows, int cols, RowFn row)
+{
+    const char *path = std::getenv("SIM_OUTPUT");
+    if (path == nullptr)
+        return;
+    std::FILE *f = std::fopen(path, "wb");
+    if (f == nullptr)
+    {
+        std::fprintf(stderr, "Failed to open output %s\n", path);
+        return;
+    }
+    for (int i = 0; i < rows; i++)
+    {
+        std::fwrite(row(i), sizeof(double), cols, f);
+    }
+    std::fclose(f);
+}
+
+inline void write_output(const double *grid, int rows, int cols)
+{
+    write_output(rows, cols, [&](int i)
+                 { return grid + (std::size_t)i * cols; });
+}
+
+#endif
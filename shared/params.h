@@ -0,0 +1,428 @@
+#ifndef SHARED_PARAMS_H
+#define SHARED_PARAMS_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "shared/config.h"
+
+// Problem sizes and physical parameters of the three simulations. The
+// constants are the defaults; every program takes overrides on the command
+// line or from a --config file (see shared/config.h):
+//
+//   heat        --n --steps --kernel w00,w01,...,w22 --tile --tile-i --tile-j
+//               --tune off|auto|search --skip off|exact|<tolerance>
+//               --band --fuse --subdomains --converge --converge-norm max|l2
+//               --converge-every --windows --coarsen --parareal-tol
+//               --parareal-max
+//   dispersion  --n --time --time-step --dx --dy --diffusion --decay
+//               --deposition --wind-x --wind-y --tile --tile-i --tile-j
+//               --band --fuse --subdomains --block --ratio --substeps
+//               --regrid --refine-above --refine-gradient
+//   shock       --n --time --yield --cell-size --chunk
+//
+// launch() parses them and calls run(params, argc, argv) with the remaining
+// positional arguments. For heat and dispersion, params is a Fixed<n> of
+// compile-time constants when the size is one of FastSizes and nothing else
+// was changed, so the usual runs compile exactly as they did with constexpr
+// parameters; anything else runs the same template with run-time values.
+// Tile sizes (--tile sets rows and columns, --tile-i and --tile-j one each),
+// --tune, --skip, the out-of-core band rows and fused steps per pass
+// (--band, --fuse) and the strips per rank of the coroutine variants
+// (--subdomains), the early stop (--converge, see shared/converge.h) and the
+// parallel-in-time options of 1/parareal (--windows, --coarsen,
+// --parareal-tol, --parareal-max) and the refinement options of 2/amr
+// (--block, --ratio, --substeps, --regrid, --refine-above,
+// --refine-gradient) stay run-time values on either path; of these only
+// --skip with a tolerance, --converge, --parareal-tol and the refinement
+// options change the result. 2/ensemble takes a comma-separated value per
+// member for --diffusion, --decay, --deposition, --wind-x and --wind-y (see
+// dispersion::Member); the other programs take one value each.
+namespace heat
+{
+    constexpr int NUM_ITERS = 100;
+    constexpr int TILE_SIZE = 64;
+    constexpr int BAND = 64;
+    constexpr int FUSE = 8;
+    constexpr int SUBDOMAINS = 4;
+    constexpr int CONVERGE_EVERY = 10;
+    constexpr int COARSEN = 2;
+    constexpr double PARAREAL_TOL = 1e-6;
+    constexpr double KERNEL[3][3] = {
+        {0.05, 0.1, 0.05},
+        {0.1, 0.4, 0.1},
+        {0.05, 0.1, 0.05},
+    };
+
+    struct Params
+    {
+        int n = GRID_SIZE;
+        int steps = NUM_ITERS;
+        int tile_i = TILE_SIZE;
+        int tile_j = TILE_SIZE;
+        std::string tune = "off"; // see shared/autotune.h
+        double skip = -1;         // tile skipping in tiled: < 0 off, 0 exact
+        int band = BAND;          // see shared/outofcore.h
+        int fuse = FUSE;
+        int subdomains = SUBDOMAINS; // see shared/coro.h
+        double converge = -1;        // see shared/converge.h; < 0 off
+        std::string converge_norm = "max";
+        int converge_every = CONVERGE_EVERY;
+        int windows = 0; // see 1/src/parareal.cpp; 0: one per thread
+        int coarsen = COARSEN;
+        double parareal_tol = PARAREAL_TOL;
+        int parareal_max = 0; // 0: --windows
+        double k[3][3] = {
+            {KERNEL[0][0], KERNEL[0][1], KERNEL[0][2]},
+            {KERNEL[1][0], KERNEL[1][1], KERNEL[1][2]},
+            {KERNEL[2][0], KERNEL[2][1], KERNEL[2][2]},
+        };
+
+        bool defaults() const
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                for (int j = 0; j < 3; j++)
+                {
+                    if (k[i][j] != KERNEL[i][j])
+                        return false;
+                }
+            }
+            return steps == NUM_ITERS;
+        }
+    };
+
+    template <int SIZE>
+    struct Fixed
+    {
+        static constexpr int n = SIZE;
+        static constexpr int steps = NUM_ITERS;
+        static constexpr const double (&k)[3][3] = KERNEL;
+        int tile_i;
+        int tile_j;
+        std::string tune;
+        double skip;
+        int band;
+        int fuse;
+        int subdomains;
+        double converge;
+        std::string converge_norm;
+        int converge_every;
+        int windows;
+        int coarsen;
+        double parareal_tol;
+        int parareal_max;
+
+        explicit Fixed(const Params &p)
+            : tile_i(p.tile_i), tile_j(p.tile_j), tune(p.tune), skip(p.skip), band(p.band), fuse(p.fuse),
+              subdomains(p.subdomains), converge(p.converge), converge_norm(p.converge_norm),
+              converge_every(p.converge_every), windows(p.windows), coarsen(p.coarsen), parareal_tol(p.parareal_tol),
+              parareal_max(p.parareal_max) {}
+    };
+
+    template <typename Run>
+    int launch(int argc, char *argv[], Run run)
+    {
+        Config cfg(argc, argv);
+        Params p;
+        cfg.get("n", p.n);
+        cfg.get("steps", p.steps);
+        cfg.get("kernel", &p.k[0][0], 9);
+        if (cfg.get("tile", p.tile_i))
+            p.tile_j = p.tile_i;
+        cfg.get("tile-i", p.tile_i);
+        cfg.get("tile-j", p.tile_j);
+        cfg.get("tune", p.tune);
+        std::string skip = "off";
+        cfg.get("skip", skip);
+        cfg.get("band", p.band);
+        cfg.get("fuse", p.fuse);
+        cfg.get("subdomains", p.subdomains);
+        cfg.get("converge", p.converge);
+        cfg.get("converge-norm", p.converge_norm);
+        cfg.get("converge-every", p.converge_every);
+        cfg.get("windows", p.windows);
+        cfg.get("coarsen", p.coarsen);
+        cfg.get("parareal-tol", p.parareal_tol);
+        cfg.get("parareal-max", p.parareal_max);
+        if (!cfg.finish())
+            return 1;
+        if (p.n < 1 || p.steps < 0 || p.tile_i < 1 || p.tile_j < 1 || p.band < 1 || p.fuse < 1 || p.subdomains < 1 ||
+            p.converge_every < 1 || p.coarsen < 1)
+        {
+            std::cerr << "--n, the tile sizes, --band, --fuse, --subdomains, --converge-every and --coarsen must be "
+                         "positive, --steps not negative"
+                      << std::endl;
+            return 1;
+        }
+        if (INT_GRID_COUNTS && !fits_int_counts(p.n))
+        {
+            std::cerr << "--n must be at most 46340 for the MPI programs" << std::endl;
+            return 1;
+        }
+        if (p.windows < 0 || p.parareal_max < 0 || p.parareal_tol < 0)
+        {
+            std::cerr << "--windows, --parareal-tol and --parareal-max must not be negative" << std::endl;
+            return 1;
+        }
+        if (p.converge_norm != "max" && p.converge_norm != "l2")
+        {
+            std::cerr << "--converge-norm must be max or l2" << std::endl;
+            return 1;
+        }
+        if (p.tune != "off" && p.tune != "auto" && p.tune != "search")
+        {
+            std::cerr << "--tune must be off, auto or search" << std::endl;
+            return 1;
+        }
+        if (skip == "exact")
+        {
+            p.skip = 0;
+        }
+        else if (skip != "off")
+        {
+            char *end = nullptr;
+            p.skip = std::strtod(skip.c_str(), &end);
+            if (skip.empty() || *end != '\0' || !(p.skip > 0))
+            {
+                std::cerr << "--skip must be off, exact or a positive tolerance" << std::endl;
+                return 1;
+            }
+        }
+        return dispatch<Fixed>(p, [&](const auto &params)
+                               { return run(params, cfg.argc(), cfg.argv()); }, FastSizes{});
+    }
+}
+
+namespace dispersion
+{
+    constexpr double DX = 10.0;
+    constexpr double DY = 10.0;
+    constexpr double SIMULATION_TIME = 100;
+    constexpr double TIME_STEP = 1;
+    constexpr int TILE_SIZE = 64;
+    constexpr int BAND = 64;
+    constexpr int FUSE = 8;
+    constexpr int SUBDOMAINS = 4;
+    constexpr int AMR_BLOCK = 32;
+    constexpr int AMR_RATIO = 2;
+    constexpr int AMR_REGRID = 10;
+    constexpr double REFINE_ABOVE = 1.0;
+    constexpr double REFINE_GRADIENT = 10.0;
+
+    constexpr double DIFFUSION_COEFF = 1000;
+    constexpr double DECAY_RATE = 3e-5;
+    constexpr double DEPOSITION_RATE = 1e-4;
+    constexpr double WIND_X = 3.3;
+    constexpr double WIND_Y = 1.4;
+
+    // The physical parameters that may differ between the members of
+    // 2/ensemble; stencil::Dispersion takes one with the shared dx, dy and
+    // time step.
+    struct Member
+    {
+        double diffusion;
+        double decay;
+        double deposition;
+        double wind_x;
+        double wind_y;
+    };
+
+    struct Params
+    {
+        int n = GRID_SIZE;
+        double time = SIMULATION_TIME;
+        double time_step = TIME_STEP;
+        int steps = 0; // time / time_step, set by launch()
+        int tile_i = TILE_SIZE;
+        int tile_j = TILE_SIZE;
+        int band = BAND; // see shared/outofcore.h
+        int fuse = FUSE;
+        int subdomains = SUBDOMAINS; // see shared/coro.h
+        int block = AMR_BLOCK;       // see 2/src/amr.cpp
+        int ratio = AMR_RATIO;
+        int substeps = 0; // 0: ratio
+        int regrid = AMR_REGRID;
+        double refine_above = REFINE_ABOVE;
+        double refine_gradient = REFINE_GRADIENT;
+        double dx = DX;
+        double dy = DY;
+        double diffusion = DIFFUSION_COEFF;
+        double decay = DECAY_RATE;
+        double deposition = DEPOSITION_RATE;
+        double wind_x = WIND_X;
+        double wind_y = WIND_Y;
+        std::vector<Member> members; // set by launch(), the values above unless an ensemble
+
+        bool defaults() const
+        {
+            return time == SIMULATION_TIME && time_step == TIME_STEP && dx == DX && dy == DY &&
+                   diffusion == DIFFUSION_COEFF && decay == DECAY_RATE && deposition == DEPOSITION_RATE &&
+                   wind_x == WIND_X && wind_y == WIND_Y;
+        }
+    };
+
+    template <int SIZE>
+    struct Fixed
+    {
+        static constexpr int n = SIZE;
+        static constexpr double time_step = TIME_STEP;
+        static constexpr int steps = (int)(SIMULATION_TIME / TIME_STEP);
+        static constexpr double dx = DX;
+        static constexpr double dy = DY;
+        static constexpr double diffusion = DIFFUSION_COEFF;
+        static constexpr double decay = DECAY_RATE;
+        static constexpr double deposition = DEPOSITION_RATE;
+        static constexpr double wind_x = WIND_X;
+        static constexpr double wind_y = WIND_Y;
+        int tile_i;
+        int tile_j;
+        int band;
+        int fuse;
+        int subdomains;
+        int block;
+        int ratio;
+        int substeps;
+        int regrid;
+        double refine_above;
+        double refine_gradient;
+        std::vector<Member> members;
+
+        explicit Fixed(const Params &p)
+            : tile_i(p.tile_i), tile_j(p.tile_j), band(p.band), fuse(p.fuse), subdomains(p.subdomains),
+              block(p.block), ratio(p.ratio), substeps(p.substeps), regrid(p.regrid), refine_above(p.refine_above),
+              refine_gradient(p.refine_gradient), members(p.members) {}
+    };
+
+    // ensemble: whether the program runs several members (2/ensemble).
+    template <typename Run>
+    int launch(int argc, char *argv[], Run run, bool ensemble = false)
+    {
+        Config cfg(argc, argv);
+        Params p;
+        cfg.get("n", p.n);
+        cfg.get("time", p.time);
+        cfg.get("time-step", p.time_step);
+        cfg.get("dx", p.dx);
+        cfg.get("dy", p.dy);
+        std::vector<double> diffusion{p.diffusion}, decay{p.decay}, deposition{p.deposition}, wind_x{p.wind_x},
+            wind_y{p.wind_y};
+        cfg.get("diffusion", diffusion);
+        cfg.get("decay", decay);
+        cfg.get("deposition", deposition);
+        cfg.get("wind-x", wind_x);
+        cfg.get("wind-y", wind_y);
+        if (cfg.get("tile", p.tile_i))
+            p.tile_j = p.tile_i;
+        cfg.get("tile-i", p.tile_i);
+        cfg.get("tile-j", p.tile_j);
+        cfg.get("band", p.band);
+        cfg.get("fuse", p.fuse);
+        cfg.get("subdomains", p.subdomains);
+        cfg.get("block", p.block);
+        cfg.get("ratio", p.ratio);
+        cfg.get("substeps", p.substeps);
+        cfg.get("regrid", p.regrid);
+        cfg.get("refine-above", p.refine_above);
+        cfg.get("refine-gradient", p.refine_gradient);
+        if (!cfg.finish())
+            return 1;
+        if (p.n < 1 || p.time < 0 || p.time_step <= 0 || p.dx <= 0 || p.dy <= 0 || p.tile_i < 1 || p.tile_j < 1 ||
+            p.band < 1 || p.fuse < 1 || p.subdomains < 1)
+        {
+            std::cerr << "--n, --time-step, --dx, --dy, the tile sizes, --band, --fuse and --subdomains must be positive, "
+                         "--time not negative"
+                      << std::endl;
+            return 1;
+        }
+        if (p.block < 1 || p.ratio < 1 || p.substeps < 0 || p.regrid < 1)
+        {
+            std::cerr << "--block, --ratio and --regrid must be positive, --substeps not negative" << std::endl;
+            return 1;
+        }
+        if (!fits_int_counts(p.n))
+        {
+            std::cerr << "--n must be at most 46340" << std::endl;
+            return 1;
+        }
+        std::vector<double> *lists[] = {&diffusion, &decay, &deposition, &wind_x, &wind_y};
+        size_t count = 1;
+        for (auto *l : lists)
+            count = std::max(count, l->size());
+        if (count > 1 && !ensemble)
+        {
+            std::cerr << "--diffusion, --decay, --deposition, --wind-x and --wind-y take one value" << std::endl;
+            return 1;
+        }
+        for (auto *l : lists)
+        {
+            if (l->size() != 1 && l->size() != count)
+            {
+                std::cerr << "Each member list needs 1 or " << count << " values" << std::endl;
+                return 1;
+            }
+        }
+        for (size_t m = 0; m < count; m++)
+        {
+            auto at = [&](const std::vector<double> &l)
+            { return l[std::min(m, l.size() - 1)]; };
+            p.members.push_back({at(diffusion), at(decay), at(deposition), at(wind_x), at(wind_y)});
+        }
+        p.diffusion = p.members[0].diffusion;
+        p.decay = p.members[0].decay;
+        p.deposition = p.members[0].deposition;
+        p.wind_x = p.members[0].wind_x;
+        p.wind_y = p.members[0].wind_y;
+        p.steps = (int)(p.time / p.time_step);
+        return dispatch<Fixed>(p, [&](const auto &params)
+                               { return run(params, cfg.argc(), cfg.argv()); }, FastSizes{});
+    }
+}
+
+// The shock wave has no fast path: each cell costs a sqrt, two log10 and ten
+// pow calls, next to which a constant loop bound or yield buys nothing.
+namespace shock
+{
+    constexpr int TIME = 100;
+    constexpr double W = 5000000000;
+    constexpr double CELL_SIZE = 10;
+    constexpr int CHUNK = 16;
+
+    struct Params
+    {
+        int n = GRID_SIZE;
+        int time = TIME;
+        double yield = W;
+        double cell_size = CELL_SIZE;
+        int chunk = CHUNK; // rows per assignment of 4/3/dynamic
+    };
+
+    template <typename Run>
+    int launch(int argc, char *argv[], Run run)
+    {
+        Config cfg(argc, argv);
+        Params p;
+        cfg.get("n", p.n);
+        cfg.get("time", p.time);
+        cfg.get("yield", p.yield);
+        cfg.get("cell-size", p.cell_size);
+        cfg.get("chunk", p.chunk);
+        if (!cfg.finish())
+            return 1;
+        if (p.n < 1 || p.time < 0 || p.yield <= 0 || p.cell_size <= 0 || p.chunk < 1)
+        {
+            std::cerr << "--n, --yield, --cell-size and --chunk must be positive, --time not negative" << std::endl;
+            return 1;
+        }
+        if (INT_GRID_COUNTS && !fits_int_counts(p.n))
+        {
+            std::cerr << "--n must be at most 46340 for the MPI programs" << std::endl;
+            return 1;
+        }
+        return run(p, cfg.argc(), cfg.argv());
+    }
+}
+
+#endif
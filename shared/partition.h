@@ -0,0 +1,32 @@
+#ifndef SHARED_PARTITION_H
+#define SHARED_PARTITION_H
+
+#include <algorithm>
+#include <vector>
+
+// Block row decomposition of an n-row grid over size ranks. The first
+// n % size ranks take one extra row, so any n >= size splits.
+inline int block_rows(int n, int size, int rank)
+{
+    return n / size + (rank < n % size ? 1 : 0);
+}
+
+inline int block_start(int n, int size, int rank)
+{
+    return rank * (n / size) + std::min(rank, n % size);
+}
+
+// Element counts and offsets of every rank's rows of width cols, for
+// MPI_Scatterv / MPI_Gatherv.
+inline void block_counts(int n, int size, int cols, std::vector<int> &counts, std::vector<int> &displs)
+{
+    counts.resize(size);
+    displs.resize(size);
+    for (int r = 0; r < size; r++)
+    {
+        counts[r] = block_rows(n, size, r) * cols;
+        displs[r] = block_start(n, size, r) * cols;
+    }
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef SHARED_PERF_COUNTERS_H
+#define SHARED_PERF_COUNTERS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Optional hardware-counter instrumentation for the time-step loops.
+//
+//   SIM_PERF=1        per-thread table and roofline summary on stderr
+//   SIM_PERF=steps    the same plus one line per time step
+//   SIM_PEAK_GFLOPS, SIM_PEAK_GBS
+//                     machine peaks; when both are set the summary says
+//                     whether the kernel is compute-, bandwidth- or
+//                     latency-bound
+//
+// Cycles, instructions and last-level cache misses are read with
+// perf_event_open for the calling thread only. Memory traffic is estimated
+// as one 64-byte line per LLC miss, next to the compulsory traffic of the
+// stencil (bytes_per_cell). Where the counters are unavailable (not Linux,
+// perf_event_paranoid > 2, no PMU in a VM) only times and the model are
+// reported. With SIM_PERF unset every call is a branch on a bool.
+namespace perf
+{
+    constexpr double LINE_BYTES = 64.0;
+
+    struct Sample
+    {
+        double seconds = 0;
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t llc_misses = 0;
+
+        Sample &operator+=(const Sample &o)
+        {
+            seconds += o.seconds;
+            cycles += o.cycles;
+            instructions += o.instructions;
+            llc_misses += o.llc_misses;
+            return *this;
+        }
+    };
+
+    enum Mode
+    {
+        OFF,
+        SUMMARY,
+        STEPS
+    };
+
+    inline Mode mode()
+    {
+        static const Mode m = []
+        {
+            const char *v = std::getenv("SIM_PERF");
+            if (v == nullptr || *v == '\0' || std::strcmp(v, "0") == 0)
+                return OFF;
+            return std::strcmp(v, "steps") == 0 ? STEPS : SUMMARY;
+        }();
+        return m;
+    }
+
+    // Cleared by the first thread that fails to open its counters, so the
+    // others do not retry and the warning is printed once. Threads open
+    // their counters concurrently, hence the atomic.
+    inline std::atomic<bool> hw_available{true};
+
+    // Cycles, instructions and LLC misses of the thread that calls start().
+    // The group is opened lazily by that thread and reopened if a different
+    // OS thread later uses the same slot.
+    struct alignas(64) Counters
+    {
+        Sample last;
+        Sample total;
+
+        Counters() = default;
+        Counters(const Counters &) = delete;
+        Counters &operator=(const Counters &) = delete;
+        ~Counters() { close(); }
+
+        void start()
+        {
+            open();
+            read(base);
+            t0 = std::chrono::steady_clock::now();
+        }
+
+        void stop()
+        {
+            auto t1 = std::chrono::steady_clock::now();
+            uint64_t now[3];
+            read(now);
+            last.seconds = std::chrono::duration<double>(t1 - t0).count();
+            last.cycles = now[0] - base[0];
+            last.instructions = now[1] - base[1];
+            last.llc_misses = now[2] - base[2];
+            total += last;
+        }
+
+    private:
+        int leader = -1;
+        long owner = -1;
+        uint64_t base[3] = {0, 0, 0};
+        std::chrono::steady_clock::time_point t0;
+
+        void close()
+        {
+#ifdef __linux__
+            for (int fd : fds)
+            {
+                if (fd >= 0)
+                    ::close(fd);
+            }
+            fds.clear();
+            leader = -1;
+#endif
+        }
+
+        void read(uint64_t *v)
+        {
+            v[0] = v[1] = v[2] = 0;
+#ifdef __linux__
+            if (leader < 0)
+                return;
+            uint64_t buf[4] = {0, 0, 0, 0};
+            if (::read(leader, buf, sizeof(buf)) == (ssize_t)sizeof(buf))
+            {
+                v[0] = buf[1];
+                v[1] = buf[2];
+                v[2] = buf[3];
+            }
+#endif
+        }
+
+#ifdef __linux__
+        std::vector<int> fds;
+
+        void open()
+        {
+            long tid = syscall(SYS_gettid);
+            if (tid == owner)
+                return;
+            close();
+            owner = tid;
+            if (!hw_available)
+                return;
+
+            const uint64_t events[3] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+            for (uint64_t config : events)
+            {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = config;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+                int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+                if (fd < 0)
+                {
+                    int err = errno;
+                    if (hw_available.exchange(false))
+                        std::fprintf(stderr, "[perf] hardware counters unavailable (%s), reporting times only\n", std::strerror(err));
+                    close();
+                    return;
+                }
+                fds.push_back(fd);
+                if (leader < 0)
+                    leader = fd;
+            }
+        }
+#else
+        void open()
+        {
+            hw_available = false;
+        }
+#endif
+    };
+
+    // Per-step and per-thread measurements of one time-step loop. cells is
+    // the number of cells updated per step, flops_per_cell and
+    // bytes_per_cell describe the kernel for the roofline summary.
+    class Session
+    {
+    public:
+        Session(const char *name, int threads, double cells, double flops_per_cell, double bytes_per_cell)
+            : name(name), cells(cells), flops_per_cell(flops_per_cell), bytes_per_cell(bytes_per_cell),
+              slots(mode() != OFF ? threads : 0)
+        {
+        }
+
+        bool enabled() const { return !slots.empty(); }
+
+        // Measure the calling thread, which uses slot i, from start to stop.
+        void start(int i)
+        {
+            if (enabled())
+                slots[i].start();
+        }
+
+        void stop(int i)
+        {
+            if (enabled())
+                slots[i].stop();
+        }
+
+        void begin_step()
+        {
+            if (!enabled())
+                return;
+            for (Counters &c : slots)
+                c.last = Sample();
+            t0 = std::chrono::steady_clock::now();
+        }
+
+        // Wall time of the step plus the counters of every thread that ran a
+        // region in it.
+        void end_step()
+        {
+            if (!enabled())
+                return;
+            auto t1 = std::chrono::steady_clock::now();
+            Sample s;
+            for (Counters &c : slots)
+                s += c.last;
+            s.seconds = std::chrono::duration<double>(t1 - t0).count();
+            steps.push_back(s);
+        }
+
+        void report()
+        {
+            if (!enabled() || steps.empty())
+                return;
+            std::string out;
+            auto line = [&](const char *fmt, auto... args)
+            {
+                char buf[256];
+                std::snprintf(buf, sizeof(buf), fmt, args...);
+                out += "[perf] ";
+                out += buf;
+                out += '\n';
+            };
+            const bool hw = hw_available;
+
+            Sample total;
+            std::vector<double> times;
+            for (const Sample &s : steps)
+            {
+                total += s;
+                times.push_back(s.seconds);
+            }
+            std::sort(times.begin(), times.end());
+            line("%s: %zu steps, %zu threads, %.4f s", name, steps.size(), slots.size(), total.seconds);
+            line("step time min/median/max: %.3f / %.3f / %.3f ms",
+                 times.front() * 1e3, times[times.size() / 2] * 1e3, times.back() * 1e3);
+
+            // Counter columns only when the counters could be read.
+            const char *header = hw ? "         cycles   instructions    IPC   LLC misses         MB" : "";
+            auto counters = [&](const Sample &s)
+            {
+                char buf[128] = "";
+                if (hw)
+                    std::snprintf(buf, sizeof(buf), " %14llu %14llu %6.2f %12llu %10.1f",
+                                  (unsigned long long)s.cycles, (unsigned long long)s.instructions,
+                                  s.cycles ? (double)s.instructions / s.cycles : 0.0,
+                                  (unsigned long long)s.llc_misses, s.llc_misses * LINE_BYTES / 1e6);
+                return std::string(buf);
+            };
+
+            if (mode() == STEPS)
+            {
+                line("%6s %10s%s", "step", "ms", header);
+                for (size_t t = 0; t < steps.size(); t++)
+                    line("%6zu %10.3f%s", t, steps[t].seconds * 1e3, counters(steps[t]).c_str());
+            }
+
+            line("%6s %10s%s", "thread", "busy s", header);
+            for (size_t i = 0; i < slots.size(); i++)
+                line("%6zu %10.4f%s", i, slots[i].total.seconds, counters(slots[i].total).c_str());
+
+            // Roofline: where (arithmetic intensity, achieved GFLOP/s) sits
+            // relative to the bandwidth slope and the compute ceiling.
+            double flops = cells * flops_per_cell * steps.size();
+            double model_bytes = cells * bytes_per_cell * steps.size();
+            double measured_bytes = total.llc_misses * LINE_BYTES;
+            double gflops = flops / total.seconds / 1e9;
+            double model_ai = flops_per_cell / bytes_per_cell;
+            line("roofline: %.0f flop/cell, %.0f B/cell compulsory -> AI %.3f flop/B (model)",
+                 flops_per_cell, bytes_per_cell, model_ai);
+            double ai = model_ai;
+            double gbs = model_bytes / total.seconds / 1e9;
+            if (hw && measured_bytes > 0)
+            {
+                ai = flops / measured_bytes;
+                gbs = measured_bytes / total.seconds / 1e9;
+                line("          LLC traffic %.1f MB -> AI %.3f flop/B (measured)", measured_bytes / 1e6, ai);
+            }
+            line("          achieved %.3f GFLOP/s, %.3f GB/s (%s)", gflops, gbs, hw && measured_bytes > 0 ? "measured" : "model");
+
+            const char *peak_flops_env = std::getenv("SIM_PEAK_GFLOPS");
+            const char *peak_bw_env = std::getenv("SIM_PEAK_GBS");
+            if (peak_flops_env == nullptr || peak_bw_env == nullptr)
+            {
+                line("          set SIM_PEAK_GFLOPS and SIM_PEAK_GBS to classify the bound");
+            }
+            else
+            {
+                double peak_flops = std::atof(peak_flops_env);
+                double peak_bw = std::atof(peak_bw_env);
+                double ridge = peak_flops / peak_bw;
+                double attainable = std::min(peak_flops, ai * peak_bw);
+                const char *bound;
+                if (ai >= ridge)
+                    bound = "compute-bound";
+                else if (gbs < 0.5 * peak_bw)
+                    bound = "latency-bound (below half the bandwidth roof)";
+                else
+                    bound = "bandwidth-bound";
+                line("          ridge %.3f flop/B, attainable %.3f GFLOP/s, at %.0f%% -> %s",
+                     ridge, attainable, 100.0 * gflops / attainable, bound);
+            }
+            std::fputs(out.c_str(), stderr);
+        }
+
+    private:
+        const char *name;
+        double cells;
+        double flops_per_cell;
+        double bytes_per_cell;
+        std::vector<Counters> slots;
+        std::vector<Sample> steps;
+        std::chrono::steady_clock::time_point t0;
+    };
+}
+
+#endif
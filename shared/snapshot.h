@@ -0,0 +1,241 @@
+#ifndef SHARED_SNAPSHOT_H
+#define SHARED_SNAPSHOT_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "shared/trace.h"
+
+// Intermediate fields written by a background thread.
+//
+//   SIM_SNAPSHOT=frames/heat build/1/tiled in.csv
+//                          frames/heat.000010.bin, frames/heat.000020.bin, ...
+//   SIM_SNAPSHOT_EVERY     steps between frames (default 10)
+//   SIM_SNAPSHOT_STRIDE    keep every s-th row and column (default 1)
+//   SIM_SNAPSHOT_ROI       region of interest "i0,j0,rows,cols" in cells of
+//                          the full grid (default the whole grid)
+//   SIM_SNAPSHOT_BUFFERS   frame buffers in flight (default 2)
+//
+// The step loop copies the selected cells into a free buffer and hands it
+// to the writer thread; it only waits when every buffer is still queued,
+// which bounds memory when the disk is slower than the solver. MPI programs
+// write one file per rank (.bin.<rank>) holding the rows of the region
+// that fall in that rank's slab.
+//
+// Each file is a Header followed by rows x cols row-major doubles; cell
+// (r, c) is cell (i0 + r * stride, j0 + c * stride) of the full grid. With
+// SIM_SNAPSHOT unset every call is a branch on a bool.
+namespace snapshot
+{
+    struct Header
+    {
+        char magic[8] = {'S', 'I', 'M', 'S', 'N', 'A', 'P', '1'};
+        int32_t step = 0;
+        int32_t rows = 0;
+        int32_t cols = 0;
+        int32_t i0 = 0;
+        int32_t j0 = 0;
+        int32_t stride = 1;
+        int32_t reserved[2] = {0, 0};
+    };
+
+    class Writer
+    {
+    public:
+        // A field of n_rows x n_cols cells of which this process holds rows
+        // [first_row, first_row + local_rows). rank >= 0 adds the rank suffix.
+        Writer(int n_rows, int n_cols, int first_row = 0, int local_rows = -1, int rank = -1)
+            : first_row(first_row), rank(rank)
+        {
+            const char *p = std::getenv("SIM_SNAPSHOT");
+            if (p == nullptr || *p == '\0')
+                return;
+            prefix = p;
+            every = std::max(1, env_int("SIM_SNAPSHOT_EVERY", 10));
+            stride = std::max(1, env_int("SIM_SNAPSHOT_STRIDE", 1));
+            int roi[4] = {0, 0, n_rows, n_cols};
+            const char *r = std::getenv("SIM_SNAPSHOT_ROI");
+            if (r != nullptr && std::sscanf(r, "%d,%d,%d,%d", &roi[0], &roi[1], &roi[2], &roi[3]) != 4)
+                std::fprintf(stderr, "[snapshot] ignoring SIM_SNAPSHOT_ROI=%s, expected i0,j0,rows,cols\n", r);
+            int i_begin = std::max(0, roi[0]);
+            int i_end = std::min(n_rows, roi[0] + roi[2]);
+            j0 = std::max(0, roi[1]);
+            int j_end = std::min(n_cols, roi[1] + roi[3]);
+            cols = j_end > j0 ? (j_end - j0 + stride - 1) / stride : 0;
+
+            // Sampled rows i_begin + k * stride that are stored here.
+            if (local_rows < 0)
+                local_rows = n_rows;
+            int lo = std::max(i_begin, first_row);
+            int hi = std::min(i_end, first_row + local_rows);
+            i0 = lo + (stride - (lo - i_begin) % stride) % stride;
+            rows = hi > i0 ? (hi - i0 + stride - 1) / stride : 0;
+
+            size_t cells = (size_t)rows * cols;
+            int count = std::max(1, env_int("SIM_SNAPSHOT_BUFFERS", 2));
+            buffers.resize(count);
+            for (auto &b : buffers)
+            {
+                b.data.resize(cells);
+                free.push_back(&b);
+            }
+            on = true;
+            worker = std::thread(&Writer::run, this);
+        }
+
+        ~Writer()
+        {
+            if (!on)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                done = true;
+            }
+            cv.notify_all();
+            worker.join();
+            if (frames > 0)
+                std::fprintf(stderr, "[snapshot] %d frames of %dx%d, step loop waited %.3f s for buffers\n",
+                             frames, rows, cols, stalled);
+        }
+
+        bool enabled() const { return on; }
+
+        // Call after time step t (1-based count of completed steps). row(i)
+        // returns the first cell of local row i; does nothing unless t is a
+        // multiple of SIM_SNAPSHOT_EVERY.
+        template <typename RowFn>
+        void step(int t, RowFn row)
+        {
+            if (!on || t % every != 0)
+                return;
+            Buffer *b;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (free.empty())
+                {
+                    trace::Span span("snapshot buffer", "wait", t);
+                    auto t0 = std::chrono::steady_clock::now();
+                    cv.wait(lock, [&]
+                            { return !free.empty(); });
+                    stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                }
+                b = free.front();
+                free.pop_front();
+            }
+            b->step = t;
+            double *out = b->data.data();
+            for (int r = 0; r < rows; r++)
+            {
+                const double *src = row(i0 + r * stride - first_row) + j0;
+                if (stride == 1)
+                {
+                    std::memcpy(out, src, cols * sizeof(double));
+                }
+                else
+                {
+                    for (int c = 0; c < cols; c++)
+                        out[c] = src[c * stride];
+                }
+                out += cols;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                ready.push_back(b);
+                frames++;
+            }
+            cv.notify_all();
+        }
+
+    private:
+        struct Buffer
+        {
+            int step = 0;
+            std::vector<double> data;
+        };
+
+        bool on = false;
+        std::string prefix;
+        int every = 10;
+        int stride = 1;
+        int first_row;
+        int rank;
+        int i0 = 0, j0 = 0, rows = 0, cols = 0;
+
+        std::vector<Buffer> buffers;
+        std::deque<Buffer *> free;
+        std::deque<Buffer *> ready;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = false;
+        int frames = 0;
+        double stalled = 0;
+        std::thread worker;
+
+        static int env_int(const char *name, int fallback)
+        {
+            const char *v = std::getenv(name);
+            return v != nullptr && *v != '\0' ? std::atoi(v) : fallback;
+        }
+
+        void run()
+        {
+            trace::name_thread("snapshot writer");
+            while (true)
+            {
+                Buffer *b;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    cv.wait(lock, [&]
+                            { return !ready.empty() || done; });
+                    if (ready.empty())
+                        return;
+                    b = ready.front();
+                    ready.pop_front();
+                }
+                write(*b);
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    free.push_back(b);
+                }
+                cv.notify_all();
+            }
+        }
+
+        void write(const Buffer &b)
+        {
+            trace::Span span("write frame", "io", b.step);
+            char name[32];
+            std::snprintf(name, sizeof(name), ".%06d.bin", b.step);
+            std::string path = prefix + name;
+            if (rank >= 0)
+                path += "." + std::to_string(rank);
+            std::FILE *f = std::fopen(path.c_str(), "wb");
+            if (f == nullptr)
+            {
+                std::fprintf(stderr, "Failed to open snapshot %s\n", path.c_str());
+                return;
+            }
+            Header h;
+            h.step = b.step;
+            h.rows = rows;
+            h.cols = cols;
+            h.i0 = i0;
+            h.j0 = j0;
+            h.stride = stride;
+            std::fwrite(&h, sizeof(h), 1, f);
+            std::fwrite(b.data.data(), sizeof(double), b.data.size(), f);
+            std::fclose(f);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef SHARED_STENCIL_H
+#define SHARED_STENCIL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// The heat and dispersion cell updates, written once for every driver.
+//
+//   stencil::Heat heat(p);                  // p from heat::launch()
+//   stencil::row(heat, up, mid, down, out, 1, N + 1);
+//
+// A stencil is built from the parameters launch() passes to the program. With
+// a Fixed<n> the weights and physical constants are compile-time constants,
+// so the update folds down to what a hand-written loop with constexpr
+// coefficients compiles to; with Params they are run-time values, copied into
+// the stencil so the compiler keeps them in registers. Cells are read from
+// three consecutive rows up, mid and down, and cell j reads columns j - 1 to
+// j + 1, so the stencils have no boundary branches: drivers keep a ring of
+// boundary cells around the field (Heat::BOUNDARY, Dispersion::BOUNDARY) and
+// receive MPI halo rows into it. Every driver sums in the order of
+// 1/sequential and 2/sequential, so results do not depend on the driver.
+namespace stencil
+{
+    // 3x3 weighted sum with the kernel of the heat parameters.
+    struct Heat
+    {
+        static constexpr double BOUNDARY = 30.0;
+        static constexpr bool COUNTS_ZERO = false;
+        double k[3][3];
+
+        template <typename Params>
+        explicit Heat(const Params &p)
+        {
+            std::copy(&p.k[0][0], &p.k[0][0] + 9, &k[0][0]);
+        }
+
+        // From nine row-major weights.
+        explicit Heat(const double *weights)
+        {
+            std::copy(weights, weights + 9, &k[0][0]);
+        }
+
+        double operator()(const double *up, const double *mid, const double *down, int j) const
+        {
+            const double *rows[3] = {up, mid, down};
+            double sum = 0;
+            for (int ki = 0; ki < 3; ki++)
+            {
+                for (int kj = 0; kj < 3; kj++)
+                {
+                    sum += rows[ki][j + kj - 1] * k[ki][kj];
+                }
+            }
+            return sum;
+        }
+    };
+
+    // Upwind advection, 5-point diffusion, decay and deposition of cell c
+    // from the cells above, below, left and right of it, clamped at 0.
+    inline double dispersion_cell(double c, double up, double down, double left, double right, double wind_x,
+                                  double wind_y, double diffusion, double decay, double deposition, double dx, double dy,
+                                  double dt)
+    {
+        double advection = wind_x * (c - up) / dx + wind_y * (c - left) / dy;
+        double diff = diffusion * (down - 2 * c + up) / (dx * dx) + diffusion * (right - 2 * c + left) / (dy * dy);
+        double loss = decay * c + deposition * c;
+        return std::max(0.0, c + dt * (-advection + diff - loss));
+    }
+
+    // dispersion_cell() with the dispersion parameters. dx, dy and dt can be
+    // set apart from the parameters for refined grids.
+    struct Dispersion
+    {
+        static constexpr double BOUNDARY = 0.0;
+        static constexpr bool COUNTS_ZERO = true;
+        double dx, dy, dt;
+        double wind_x, wind_y, diffusion, decay, deposition;
+
+        template <typename Params>
+        explicit Dispersion(const Params &p) : Dispersion(p, p.dx, p.dy, p.time_step) {}
+
+        template <typename Params>
+        Dispersion(const Params &p, double dx, double dy, double dt)
+            : dx(dx), dy(dy), dt(dt), wind_x(p.wind_x), wind_y(p.wind_y), diffusion(p.diffusion), decay(p.decay),
+              deposition(p.deposition) {}
+
+        double operator()(const double *up, const double *mid, const double *down, int j) const
+        {
+            return dispersion_cell(mid[j], up[j], down[j], mid[j - 1], mid[j + 1], wind_x, wind_y, diffusion, decay,
+                                   deposition, dx, dy, dt);
+        }
+    };
+
+    // Dispersion of an ensemble stored interleaved: every cell holds lanes
+    // consecutive values, lane m a member with its own physical parameters
+    // and the shared dx, dy and time step. lanes is the member count rounded
+    // up to a multiple of LANES so each cell fills whole vectors; the padding
+    // lanes repeat the last member.
+    struct DispersionLanes
+    {
+        static constexpr double BOUNDARY = 0.0;
+        static constexpr int LANES = 4;
+        int lanes;
+        double dx, dy, dt;
+        std::vector<double> wind_x, wind_y, diffusion, decay, deposition;
+
+        // members: anything with the physical parameters of a member, such
+        // as dispersion::Member.
+        template <typename Params, typename Members>
+        DispersionLanes(const Params &p, const Members &members)
+            : lanes((int)(members.size() + LANES - 1) / LANES * LANES), dx(p.dx), dy(p.dy), dt(p.time_step)
+        {
+            for (int m = 0; m < lanes; m++)
+            {
+                const auto &member = members[std::min((size_t)m, members.size() - 1)];
+                wind_x.push_back(member.wind_x);
+                wind_y.push_back(member.wind_y);
+                diffusion.push_back(member.diffusion);
+                decay.push_back(member.decay);
+                deposition.push_back(member.deposition);
+            }
+        }
+    };
+
+    // Cells [j0, j1) of the row mid: out[j] = s(up, mid, down, j). Returns
+    // how many of them came out 0 for stencils that count them (Dispersion's
+    // uncontaminated cells), otherwise 0. Works on a local copy of s, which
+    // out cannot alias, so the coefficients stay in registers.
+    template <typename S>
+    inline int row(const S &s, const double *up, const double *mid, const double *down, double *out, int j0, int j1)
+    {
+        const S local = s;
+        int zero = 0;
+        for (int j = j0; j < j1; j++)
+        {
+            double v = local(up, mid, down, j);
+            out[j] = v;
+            if constexpr (S::COUNTS_ZERO)
+                zero += v == 0;
+        }
+        return zero;
+    }
+
+    // Row i of a padded field of row stride w: rows i - 1 .. i + 1 of in,
+    // written to the same row of out.
+    template <typename S>
+    inline int row(const S &s, const double *in, double *out, long w, int i, int j0, int j1)
+    {
+        return row(s, in + (i - 1) * w, in + i * w, in + (i + 1) * w, out + i * w, j0, j1);
+    }
+
+    // Cells [j0, j1) of the interleaved row mid, every lane in one vector
+    // loop per cell; adds the cells of lane m that came out 0 to zero[m].
+    // LANES is s.lanes when it is a compile-time constant (the lane loop then
+    // unrolls into whole vectors), 0 otherwise.
+    template <int LANES = 0>
+    inline void row(const DispersionLanes &s, const double *up, const double *mid, const double *down, double *out, int j0,
+                    int j1, int *zero)
+    {
+        const int L = LANES ? LANES : s.lanes;
+        const double dx = s.dx, dy = s.dy, dt = s.dt;
+        const double *wx = s.wind_x.data(), *wy = s.wind_y.data(), *dc = s.diffusion.data(), *dec = s.decay.data(),
+                     *dep = s.deposition.data();
+        for (int j = j0; j < j1; j++)
+        {
+            const size_t c = (size_t)j * L;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+            for (int m = 0; m < L; m++)
+            {
+                double v = dispersion_cell(mid[c + m], up[c + m], down[c + m], mid[c - L + m], mid[c + L + m], wx[m],
+                                           wy[m], dc[m], dec[m], dep[m], dx, dy, dt);
+                out[c + m] = v;
+                zero[m] += v == 0;
+            }
+        }
+    }
+}
+
+#endif
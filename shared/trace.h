@@ -0,0 +1,198 @@
+#ifndef SHARED_TRACE_H
+#define SHARED_TRACE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline tracing in Chrome trace format, viewable offline in
+// chrome://tracing or ui.perfetto.dev.
+//
+//   SIM_TRACE=trace.json build/3/threadpool 4
+//   SIM_TRACE=trace.json mpirun -np 4 build/4/2/async in.csv
+//                    one file per rank, trace.json.0 .. trace.json.3
+//   python3 bench/merge_traces.py trace.json.* > all.json
+//
+// Every thread appends to its own ring buffer of SIM_TRACE_EVENTS events
+// (default 65536, the oldest are overwritten), so recording a span is two
+// clock reads and a store with no locking. The buffers are written out when
+// the process exits. Spans are tagged compute, wait or comm. With SIM_TRACE
+// unset a span costs one branch.
+namespace trace
+{
+    struct Event
+    {
+        const char *name;
+        const char *cat;
+        int64_t begin_ns;
+        int64_t end_ns;
+        int64_t arg;
+    };
+
+    // Written only by its own thread; read once at exit.
+    struct Buffer
+    {
+        int tid;
+        std::string thread_name;
+        std::vector<Event> ring;
+        uint64_t count = 0;
+
+        void push(const Event &e)
+        {
+            ring[count % ring.size()] = e;
+            count++;
+        }
+    };
+
+    inline int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    class Recorder
+    {
+    public:
+        const char *path = std::getenv("SIM_TRACE");
+        int pid = 0;
+        bool per_rank = false;
+
+        static Recorder &get()
+        {
+            static Recorder r;
+            return r;
+        }
+
+        bool enabled() const { return path != nullptr && *path != '\0'; }
+
+        Buffer *buffer()
+        {
+            thread_local Buffer *b = nullptr;
+            if (b == nullptr)
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                buffers.push_back(std::make_unique<Buffer>());
+                b = buffers.back().get();
+                b->tid = (int)buffers.size() - 1;
+                b->thread_name = b->tid == 0 ? "main" : "thread " + std::to_string(b->tid);
+                b->ring.resize(capacity());
+            }
+            return b;
+        }
+
+        ~Recorder()
+        {
+            if (enabled())
+                write();
+        }
+
+    private:
+        std::mutex mtx;
+        std::vector<std::unique_ptr<Buffer>> buffers;
+
+        static size_t capacity()
+        {
+            const char *v = std::getenv("SIM_TRACE_EVENTS");
+            long n = v != nullptr ? std::atol(v) : 0;
+            return n > 0 ? (size_t)n : 65536;
+        }
+
+        void write()
+        {
+            std::string file = per_rank ? std::string(path) + "." + std::to_string(pid) : std::string(path);
+            std::FILE *f = std::fopen(file.c_str(), "w");
+            if (f == nullptr)
+            {
+                std::fprintf(stderr, "Failed to open trace %s\n", file.c_str());
+                return;
+            }
+            std::fprintf(f, "{\"traceEvents\":[\n");
+            std::fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                         pid, per_rank ? "rank" : "process", pid);
+            for (const auto &b : buffers)
+            {
+                std::fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                             pid, b->tid, b->thread_name.c_str());
+                uint64_t n = std::min<uint64_t>(b->count, b->ring.size());
+                for (uint64_t k = b->count - n; k < b->count; k++)
+                {
+                    const Event &e = b->ring[k % b->ring.size()];
+                    std::fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                                 e.name, e.cat, pid, b->tid, e.begin_ns / 1e3, (e.end_ns - e.begin_ns) / 1e3);
+                    if (e.arg >= 0)
+                        std::fprintf(f, ",\"args\":{\"step\":%lld}", (long long)e.arg);
+                    std::fprintf(f, "}");
+                }
+                if (b->count > b->ring.size())
+                    std::fprintf(stderr, "[trace] %s dropped %llu oldest events, raise SIM_TRACE_EVENTS\n",
+                                 b->thread_name.c_str(), (unsigned long long)(b->count - b->ring.size()));
+            }
+            std::fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+            std::fclose(f);
+        }
+    };
+
+    inline bool enabled()
+    {
+        static const bool on = Recorder::get().enabled();
+        return on;
+    }
+
+    // MPI programs call this after MPI_Init: the rank becomes the trace pid
+    // and the output file gets a .<rank> suffix.
+    inline void set_rank(int rank)
+    {
+        if (!enabled())
+            return;
+        Recorder::get().pid = rank;
+        Recorder::get().per_rank = true;
+    }
+
+    inline void name_thread(const std::string &name)
+    {
+        if (enabled())
+            Recorder::get().buffer()->thread_name = name;
+    }
+
+    // Records [construction, destruction) on the calling thread. name and cat
+    // must be string literals; arg (e.g. the time step) is shown when >= 0.
+    class Span
+    {
+    public:
+        Span(const char *name, const char *cat, int64_t arg = -1)
+        {
+            if (!enabled())
+                return;
+            b = Recorder::get().buffer();
+            e = {name, cat, now_ns(), 0, arg};
+        }
+
+        ~Span() { end(); }
+
+        // Closes the span early, e.g. before a barrier in the same scope.
+        void end()
+        {
+            if (b == nullptr)
+                return;
+            e.end_ns = now_ns();
+            b->push(e);
+            b = nullptr;
+        }
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+    private:
+        Buffer *b = nullptr;
+        Event e;
+    };
+}
+
+#endif
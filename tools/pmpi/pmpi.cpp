@@ -0,0 +1,571 @@
+// PMPI interposer: counts calls, bytes and time spent in every MPI function
+// the simulations use, per rank and per phase, and prints a per-rank table
+// and a rank-imbalance summary on stderr at MPI_Finalize.
+//
+//   make pmpi
+//   mpirun -np 4 -x LD_PRELOAD=$PWD/build/tools/libpmpi.so build/4/2/async in.csv
+//
+// Phases are marked with MPI_Pcontrol, a no-op without this library:
+// MPI_Pcontrol(1) starts the step loop, MPI_Pcontrol(2) ends it. Everything
+// before is setup (including reading the input on rank 0), everything after
+// is output. A program without markers is reported as one phase.
+//
+// SIM_PMPI_CSV=path also writes the full table (rank, phase, function,
+// calls, bytes, seconds) as CSV from rank 0.
+#include <mpi.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#define PMPI_FUNCTIONS(X) \
+    X(Send)               \
+    X(Recv)               \
+    X(Isend)              \
+    X(Irecv)              \
+    X(Sendrecv)           \
+    X(Probe)              \
+    X(Iprobe)             \
+    X(Wait)               \
+    X(Waitall)            \
+    X(Waitany)            \
+    X(Waitsome)           \
+    X(Test)               \
+    X(Testall)            \
+    X(Testsome)           \
+    X(Barrier)            \
+    X(Bcast)              \
+    X(Scatter)            \
+    X(Scatterv)           \
+    X(Gather)             \
+    X(Gatherv)            \
+    X(Igatherv)           \
+    X(Reduce)             \
+    X(Ireduce)            \
+    X(Allreduce)          \
+    X(Put)                \
+    X(Get)                \
+    X(Win_post)           \
+    X(Win_start)          \
+    X(Win_complete)       \
+    X(Win_wait)           \
+    X(Win_fence)          \
+    X(Win_sync)           \
+    X(Win_lock_all)       \
+    X(Win_unlock_all)     \
+    X(Win_allocate)       \
+    X(Win_allocate_shared)\
+    X(Win_free)
+
+enum Fn
+{
+#define X(name) F_##name,
+    PMPI_FUNCTIONS(X)
+#undef X
+        NUM_FN
+};
+
+static const char *fn_names[NUM_FN] = {
+#define X(name) "MPI_" #name,
+    PMPI_FUNCTIONS(X)
+#undef X
+};
+
+enum Phase
+{
+    SETUP,
+    LOOP,
+    OUTPUT,
+    NUM_PHASES
+};
+
+static const char *phase_names[NUM_PHASES] = {"setup", "loop", "output"};
+
+// Per rank: calls, bytes, seconds for every (phase, function), then the wall
+// time of every phase. Sent to rank 0 as one array at MPI_Finalize.
+constexpr int CALLS = 0;
+constexpr int BYTES = 1;
+constexpr int SECONDS = 2;
+constexpr int STATS = (int)NUM_PHASES * NUM_FN * 3 + NUM_PHASES;
+
+static double stats[STATS];
+static int phase = SETUP;
+static double phase_start = 0;
+
+static double &stat(int p, int f, int k)
+{
+    return stats[(p * NUM_FN + f) * 3 + k];
+}
+
+static double &wall(int p)
+{
+    return stats[(int)NUM_PHASES * NUM_FN * 3 + p];
+}
+
+static double bytes(int count, MPI_Datatype type)
+{
+    int size = 0;
+    PMPI_Type_size(type, &size);
+    return (double)count * size;
+}
+
+static int comm_size(MPI_Comm comm)
+{
+    int size = 0;
+    PMPI_Comm_size(comm, &size);
+    return size;
+}
+
+template <typename Call>
+static int timed(Fn f, double nbytes, Call call)
+{
+    double t0 = PMPI_Wtime();
+    int rc = call();
+    stat(phase, f, CALLS) += 1;
+    stat(phase, f, BYTES) += nbytes;
+    stat(phase, f, SECONDS) += PMPI_Wtime() - t0;
+    return rc;
+}
+
+static void enter_phase(int p)
+{
+    double now = PMPI_Wtime();
+    wall(phase) += now - phase_start;
+    phase = p;
+    phase_start = now;
+}
+
+static void report();
+
+extern "C"
+{
+    int MPI_Init(int *argc, char ***argv)
+    {
+        int rc = PMPI_Init(argc, argv);
+        phase_start = PMPI_Wtime();
+        return rc;
+    }
+
+    int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
+    {
+        int rc = PMPI_Init_thread(argc, argv, required, provided);
+        phase_start = PMPI_Wtime();
+        return rc;
+    }
+
+    int MPI_Pcontrol(const int level, ...)
+    {
+        if (level == 1 || level == 2)
+            enter_phase(level == 1 ? LOOP : OUTPUT);
+        return MPI_SUCCESS;
+    }
+
+    int MPI_Finalize(void)
+    {
+        enter_phase(phase);
+        report();
+        return PMPI_Finalize();
+    }
+
+    int MPI_Send(const void *buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)
+    {
+        return timed(F_Send, bytes(count, type), [&]
+                     { return PMPI_Send(buf, count, type, dest, tag, comm); });
+    }
+
+    int MPI_Recv(void *buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status *status)
+    {
+        return timed(F_Recv, bytes(count, type), [&]
+                     { return PMPI_Recv(buf, count, type, source, tag, comm, status); });
+    }
+
+    int MPI_Isend(const void *buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request *req)
+    {
+        return timed(F_Isend, bytes(count, type), [&]
+                     { return PMPI_Isend(buf, count, type, dest, tag, comm, req); });
+    }
+
+    int MPI_Irecv(void *buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request *req)
+    {
+        return timed(F_Irecv, bytes(count, type), [&]
+                     { return PMPI_Irecv(buf, count, type, source, tag, comm, req); });
+    }
+
+    int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag,
+                     void *recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag,
+                     MPI_Comm comm, MPI_Status *status)
+    {
+        return timed(F_Sendrecv, bytes(sendcount, sendtype) + bytes(recvcount, recvtype), [&]
+                     { return PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag,
+                                            recvbuf, recvcount, recvtype, source, recvtag, comm, status); });
+    }
+
+    int MPI_Probe(int source, int tag, MPI_Comm comm, MPI_Status *status)
+    {
+        return timed(F_Probe, 0, [&]
+                     { return PMPI_Probe(source, tag, comm, status); });
+    }
+
+    int MPI_Iprobe(int source, int tag, MPI_Comm comm, int *flag, MPI_Status *status)
+    {
+        return timed(F_Iprobe, 0, [&]
+                     { return PMPI_Iprobe(source, tag, comm, flag, status); });
+    }
+
+    int MPI_Wait(MPI_Request *req, MPI_Status *status)
+    {
+        return timed(F_Wait, 0, [&]
+                     { return PMPI_Wait(req, status); });
+    }
+
+    int MPI_Waitall(int count, MPI_Request reqs[], MPI_Status statuses[])
+    {
+        return timed(F_Waitall, 0, [&]
+                     { return PMPI_Waitall(count, reqs, statuses); });
+    }
+
+    int MPI_Waitany(int count, MPI_Request reqs[], int *index, MPI_Status *status)
+    {
+        return timed(F_Waitany, 0, [&]
+                     { return PMPI_Waitany(count, reqs, index, status); });
+    }
+
+    int MPI_Waitsome(int incount, MPI_Request reqs[], int *outcount, int indices[], MPI_Status statuses[])
+    {
+        return timed(F_Waitsome, 0, [&]
+                     { return PMPI_Waitsome(incount, reqs, outcount, indices, statuses); });
+    }
+
+    int MPI_Test(MPI_Request *req, int *flag, MPI_Status *status)
+    {
+        return timed(F_Test, 0, [&]
+                     { return PMPI_Test(req, flag, status); });
+    }
+
+    int MPI_Testall(int count, MPI_Request reqs[], int *flag, MPI_Status statuses[])
+    {
+        return timed(F_Testall, 0, [&]
+                     { return PMPI_Testall(count, reqs, flag, statuses); });
+    }
+
+    int MPI_Testsome(int incount, MPI_Request reqs[], int *outcount, int indices[], MPI_Status statuses[])
+    {
+        return timed(F_Testsome, 0, [&]
+                     { return PMPI_Testsome(incount, reqs, outcount, indices, statuses); });
+    }
+
+    int MPI_Barrier(MPI_Comm comm)
+    {
+        return timed(F_Barrier, 0, [&]
+                     { return PMPI_Barrier(comm); });
+    }
+
+    int MPI_Bcast(void *buf, int count, MPI_Datatype type, int root, MPI_Comm comm)
+    {
+        return timed(F_Bcast, bytes(count, type), [&]
+                     { return PMPI_Bcast(buf, count, type, root, comm); });
+    }
+
+    // Collectives count what this rank sends plus what it receives; the root
+    // of a scatter or gather moves the whole array.
+    int MPI_Scatter(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                    void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+    {
+        int rank;
+        PMPI_Comm_rank(comm, &rank);
+        double n = bytes(recvcount, recvtype) + (rank == root ? bytes(sendcount, sendtype) * comm_size(comm) : 0);
+        return timed(F_Scatter, n, [&]
+                     { return PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm); });
+    }
+
+    int MPI_Scatterv(const void *sendbuf, const int sendcounts[], const int displs[], MPI_Datatype sendtype,
+                     void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+    {
+        int rank;
+        PMPI_Comm_rank(comm, &rank);
+        double n = bytes(recvcount, recvtype);
+        if (rank == root)
+        {
+            for (int p = 0; p < comm_size(comm); p++)
+                n += bytes(sendcounts[p], sendtype);
+        }
+        return timed(F_Scatterv, n, [&]
+                     { return PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm); });
+    }
+
+    int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                   void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+    {
+        int rank;
+        PMPI_Comm_rank(comm, &rank);
+        double n = bytes(sendcount, sendtype) + (rank == root ? bytes(recvcount, recvtype) * comm_size(comm) : 0);
+        return timed(F_Gather, n, [&]
+                     { return PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm); });
+    }
+
+    int MPI_Gatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                    void *recvbuf, const int recvcounts[], const int displs[], MPI_Datatype recvtype, int root, MPI_Comm comm)
+    {
+        int rank;
+        PMPI_Comm_rank(comm, &rank);
+        double n = bytes(sendcount, sendtype);
+        if (rank == root)
+        {
+            for (int p = 0; p < comm_size(comm); p++)
+                n += bytes(recvcounts[p], recvtype);
+        }
+        return timed(F_Gatherv, n, [&]
+                     { return PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm); });
+    }
+
+    int MPI_Igatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                     void *recvbuf, const int recvcounts[], const int displs[], MPI_Datatype recvtype, int root,
+                     MPI_Comm comm, MPI_Request *req)
+    {
+        int rank;
+        PMPI_Comm_rank(comm, &rank);
+        double n = bytes(sendcount, sendtype);
+        if (rank == root)
+        {
+            for (int p = 0; p < comm_size(comm); p++)
+                n += bytes(recvcounts[p], recvtype);
+        }
+        return timed(F_Igatherv, n, [&]
+                     { return PMPI_Igatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm, req); });
+    }
+
+    int MPI_Reduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm)
+    {
+        return timed(F_Reduce, bytes(count, type), [&]
+                     { return PMPI_Reduce(sendbuf, recvbuf, count, type, op, root, comm); });
+    }
+
+    int MPI_Ireduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op, int root,
+                    MPI_Comm comm, MPI_Request *req)
+    {
+        return timed(F_Ireduce, bytes(count, type), [&]
+                     { return PMPI_Ireduce(sendbuf, recvbuf, count, type, op, root, comm, req); });
+    }
+
+    int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+    {
+        return timed(F_Allreduce, 2 * bytes(count, type), [&]
+                     { return PMPI_Allreduce(sendbuf, recvbuf, count, type, op, comm); });
+    }
+
+    int MPI_Put(const void *origin, int origin_count, MPI_Datatype origin_type, int target, MPI_Aint disp,
+                int target_count, MPI_Datatype target_type, MPI_Win win)
+    {
+        return timed(F_Put, bytes(origin_count, origin_type), [&]
+                     { return PMPI_Put(origin, origin_count, origin_type, target, disp, target_count, target_type, win); });
+    }
+
+    int MPI_Get(void *origin, int origin_count, MPI_Datatype origin_type, int target, MPI_Aint disp,
+                int target_count, MPI_Datatype target_type, MPI_Win win)
+    {
+        return timed(F_Get, bytes(origin_count, origin_type), [&]
+                     { return PMPI_Get(origin, origin_count, origin_type, target, disp, target_count, target_type, win); });
+    }
+
+    int MPI_Win_post(MPI_Group group, int assert, MPI_Win win)
+    {
+        return timed(F_Win_post, 0, [&]
+                     { return PMPI_Win_post(group, assert, win); });
+    }
+
+    int MPI_Win_start(MPI_Group group, int assert, MPI_Win win)
+    {
+        return timed(F_Win_start, 0, [&]
+                     { return PMPI_Win_start(group, assert, win); });
+    }
+
+    int MPI_Win_complete(MPI_Win win)
+    {
+        return timed(F_Win_complete, 0, [&]
+                     { return PMPI_Win_complete(win); });
+    }
+
+    int MPI_Win_wait(MPI_Win win)
+    {
+        return timed(F_Win_wait, 0, [&]
+                     { return PMPI_Win_wait(win); });
+    }
+
+    int MPI_Win_fence(int assert, MPI_Win win)
+    {
+        return timed(F_Win_fence, 0, [&]
+                     { return PMPI_Win_fence(assert, win); });
+    }
+
+    int MPI_Win_sync(MPI_Win win)
+    {
+        return timed(F_Win_sync, 0, [&]
+                     { return PMPI_Win_sync(win); });
+    }
+
+    int MPI_Win_lock_all(int assert, MPI_Win win)
+    {
+        return timed(F_Win_lock_all, 0, [&]
+                     { return PMPI_Win_lock_all(assert, win); });
+    }
+
+    int MPI_Win_unlock_all(MPI_Win win)
+    {
+        return timed(F_Win_unlock_all, 0, [&]
+                     { return PMPI_Win_unlock_all(win); });
+    }
+
+    int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm, void *baseptr, MPI_Win *win)
+    {
+        return timed(F_Win_allocate, 0, [&]
+                     { return PMPI_Win_allocate(size, disp_unit, info, comm, baseptr, win); });
+    }
+
+    int MPI_Win_allocate_shared(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm, void *baseptr, MPI_Win *win)
+    {
+        return timed(F_Win_allocate_shared, 0, [&]
+                     { return PMPI_Win_allocate_shared(size, disp_unit, info, comm, baseptr, win); });
+    }
+
+    int MPI_Win_free(MPI_Win *win)
+    {
+        return timed(F_Win_free, 0, [&]
+                     { return PMPI_Win_free(win); });
+    }
+}
+
+static double mpi_time(const double *s, int p)
+{
+    double t = 0;
+    for (int f = 0; f < NUM_FN; f++)
+        t += s[(p * NUM_FN + f) * 3 + SECONDS];
+    return t;
+}
+
+static void report()
+{
+    int rank, size;
+    PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    PMPI_Comm_size(MPI_COMM_WORLD, &size);
+    std::vector<double> all(rank == 0 ? (size_t)STATS * size : 0);
+    PMPI_Gather(stats, STATS, MPI_DOUBLE, all.data(), STATS, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank != 0)
+        return;
+
+    auto at = [&](int r, int p, int f, int k)
+    { return all[(size_t)r * STATS + (p * NUM_FN + f) * 3 + k]; };
+    auto wall_of = [&](int r, int p)
+    { return all[(size_t)r * STATS + (int)NUM_PHASES * NUM_FN * 3 + p]; };
+
+    // Without MPI_Pcontrol markers everything landed in the first phase.
+    bool marked = false;
+    for (int r = 0; r < size; r++)
+        marked = marked || wall_of(r, LOOP) > 0;
+    int phases = marked ? NUM_PHASES : 1;
+
+    std::string out;
+    auto line = [&](const char *fmt, auto... args)
+    {
+        char buf[512];
+        std::snprintf(buf, sizeof(buf), fmt, args...);
+        out += "[pmpi] ";
+        out += buf;
+        out += '\n';
+    };
+
+    line("%4s %-6s %9s %9s %5s  %s", "rank", "phase", "wall s", "MPI s", "MPI%", "top functions (s)");
+    for (int r = 0; r < size; r++)
+    {
+        const double *s = &all[(size_t)r * STATS];
+        for (int p = 0; p < phases; p++)
+        {
+            std::vector<int> order;
+            for (int f = 0; f < NUM_FN; f++)
+            {
+                if (at(r, p, f, CALLS) > 0)
+                    order.push_back(f);
+            }
+            std::sort(order.begin(), order.end(), [&](int a, int b)
+                      { return at(r, p, a, SECONDS) > at(r, p, b, SECONDS); });
+            std::string top;
+            for (size_t i = 0; i < order.size() && i < 3; i++)
+            {
+                char buf[64];
+                std::snprintf(buf, sizeof(buf), "%s%s %.4f", i ? ", " : "", fn_names[order[i]], at(r, p, order[i], SECONDS));
+                top += buf;
+            }
+            double w = wall_of(r, p);
+            double m = mpi_time(s, p);
+            line("%4d %-6s %9.4f %9.4f %4.0f%%  %s", r, marked ? phase_names[p] : "all", w, m,
+                 w > 0 ? 100.0 * m / w : 0.0, top.c_str());
+        }
+    }
+
+    // Imbalance in the step loop (or the whole run): compute is the wall
+    // time not spent inside MPI.
+    int p = marked ? LOOP : SETUP;
+    double cmin = 1e300, cmax = 0, csum = 0, mmin = 1e300, mmax = 0, msum = 0;
+    for (int r = 0; r < size; r++)
+    {
+        double m = mpi_time(&all[(size_t)r * STATS], p);
+        double c = wall_of(r, p) - m;
+        cmin = std::min(cmin, c);
+        cmax = std::max(cmax, c);
+        csum += c;
+        mmin = std::min(mmin, m);
+        mmax = std::max(mmax, m);
+        msum += m;
+    }
+    double cmean = csum / size;
+    line("%s imbalance over %d ranks: compute min/mean/max %.4f/%.4f/%.4f s (max/mean %.2f), MPI min/mean/max %.4f/%.4f/%.4f s",
+         marked ? "loop" : "run", size, cmin, cmean, cmax, cmean > 0 ? cmax / cmean : 0.0, mmin, msum / size, mmax);
+
+    line("%-24s %10s %12s %28s", "function", "calls", "MB", "time min/mean/max s");
+    for (int f = 0; f < NUM_FN; f++)
+    {
+        double calls = 0, mb = 0, tmin = 1e300, tmax = 0, tsum = 0;
+        for (int r = 0; r < size; r++)
+        {
+            double t = 0;
+            for (int q = 0; q < NUM_PHASES; q++)
+            {
+                calls += at(r, q, f, CALLS);
+                mb += at(r, q, f, BYTES) / 1e6;
+                t += at(r, q, f, SECONDS);
+            }
+            tmin = std::min(tmin, t);
+            tmax = std::max(tmax, t);
+            tsum += t;
+        }
+        if (calls > 0)
+            line("%-24s %10.0f %12.3f %10.4f/%.4f/%.4f", fn_names[f], calls, mb, tmin, tsum / size, tmax);
+    }
+    std::fputs(out.c_str(), stderr);
+
+    const char *csv = std::getenv("SIM_PMPI_CSV");
+    if (csv == nullptr)
+        return;
+    std::FILE *f = std::fopen(csv, "w");
+    if (f == nullptr)
+    {
+        std::fprintf(stderr, "Failed to open %s\n", csv);
+        return;
+    }
+    std::fprintf(f, "rank,phase,function,calls,bytes,seconds\n");
+    for (int r = 0; r < size; r++)
+    {
+        for (int q = 0; q < phases; q++)
+        {
+            const char *name = marked ? phase_names[q] : "all";
+            std::fprintf(f, "%d,%s,wall,0,0,%.9f\n", r, name, wall_of(r, q));
+            for (int fn = 0; fn < NUM_FN; fn++)
+            {
+                if (at(r, q, fn, CALLS) > 0)
+                    std::fprintf(f, "%d,%s,%s,%.0f,%.0f,%.9f\n", r, name, fn_names[fn],
+                                 at(r, q, fn, CALLS), at(r, q, fn, BYTES), at(r, q, fn, SECONDS));
+            }
+        }
+    }
+    std::fclose(f);
+}